@@ -0,0 +1,259 @@
+#include "apiratelimiter.h"
+
+#include <QNetworkReply>
+#include <QDateTime>
+#include <QTimeZone>
+#include <QSettings>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDebug>
+
+#define SEARCH_QUOTA_COST 100
+#define VIDEOS_QUOTA_COST 1
+#define BACKGROUND_QUOTA_SHARE 0.8
+#define BACKOFF_BASE_DELAY 1000
+#define BACKOFF_MAXIMUM_DELAY 300000
+
+APIRateLimiter *APIRateLimiter::_singleton = 0;
+
+//The Data API quota is reset at midnight Pacific time
+static QTimeZone quotaTimeZone()
+{
+    QTimeZone timeZone("America/Los_Angeles");
+    if(!timeZone.isValid()) timeZone = QTimeZone(-8 * 60 * 60);
+    return timeZone;
+}
+
+class APIRateLimiterPrivate
+{
+public:
+    APIRateLimiterPrivate() :
+        quotaLimit(10000),
+        quotaUsed(0),
+        bucketSize(1000),
+        refillRate(300),
+        tokens(0),
+        lastRefill(0),
+        failures(0),
+        backoffUntil(0),
+        pausedUntil(0)
+    {
+        QSettings settings("beatwhale_config.ini", QSettings::IniFormat);
+        quotaLimit = settings.value("api_quota", quotaLimit).toInt();
+        bucketSize = settings.value("api_bucket_size", bucketSize).toInt();
+        refillRate = settings.value("api_bucket_refill", refillRate).toInt();
+
+        tokens = bucketSize;
+        lastRefill = QDateTime::currentMSecsSinceEpoch();
+    }
+
+    virtual ~APIRateLimiterPrivate()
+    {
+    }
+
+    void refill()
+    {
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+        //Refill rate is in quota units per minute
+        tokens = qMin(double(bucketSize), tokens + (now - lastRefill) * refillRate / 60000.0);
+        lastRefill = now;
+
+        QDate today = QDateTime::currentDateTime().toTimeZone(quotaTimeZone()).date();
+        if(quotaDate != today)
+        {
+            quotaDate = today;
+            quotaUsed = 0;
+        }
+    }
+
+    int quotaLimit;
+    int quotaUsed;
+    QDate quotaDate;
+
+    int bucketSize;
+    int refillRate;
+    double tokens;
+    qint64 lastRefill;
+
+    int failures;
+    qint64 backoffUntil;
+    qint64 pausedUntil;
+};
+
+APIRateLimiter::APIRateLimiter(QObject *parent) :
+    QObject(parent),
+    d_ptr(new APIRateLimiterPrivate)
+{
+}
+
+APIRateLimiter::~APIRateLimiter()
+{
+    delete d_ptr;
+}
+
+APIRateLimiter *APIRateLimiter::singleton()
+{
+    if(!_singleton)
+    {
+        _singleton = new APIRateLimiter;
+    }
+    return _singleton;
+}
+
+void APIRateLimiter::declareQML()
+{
+    qmlRegisterSingletonType<APIRateLimiter>("BeatWhaleAPI", 1, 0, "APIRateLimiter", qmlAPIRateLimiterSingleton);
+}
+
+int APIRateLimiter::cost(const Endpoint &endpoint)
+{
+    switch(endpoint)
+    {
+    case ENDPOINT_SEARCH:
+        return SEARCH_QUOTA_COST;
+    case ENDPOINT_VIDEOS:
+    default:
+        return VIDEOS_QUOTA_COST;
+    }
+}
+
+bool APIRateLimiter::canAcquire(const Endpoint &endpoint, const Priority &priority)
+{
+    Q_D(APIRateLimiter);
+
+    d->refill();
+
+    if(quotaExceeded()) return false;
+
+    //Essential calls are user actions, they only stop when the quota is gone
+    if(priority == PRIORITY_ESSENTIAL) return true;
+
+    if(QDateTime::currentMSecsSinceEpoch() < d->backoffUntil) return false;
+    if(d->quotaUsed + cost(endpoint) > d->quotaLimit * BACKGROUND_QUOTA_SHARE) return false;
+
+    return d->tokens >= cost(endpoint);
+}
+
+bool APIRateLimiter::acquire(const Endpoint &endpoint, const Priority &priority)
+{
+    Q_D(APIRateLimiter);
+
+    if(!canAcquire(endpoint, priority)) return false;
+
+    d->tokens = qMax(0.0, d->tokens - cost(endpoint));
+    d->quotaUsed += cost(endpoint);
+
+    emit usageChanged();
+    return true;
+}
+
+void APIRateLimiter::reportSuccess()
+{
+    Q_D(APIRateLimiter);
+
+    if(!d->failures) return;
+
+    d->failures = 0;
+    d->backoffUntil = 0;
+
+    emit usageChanged();
+}
+
+void APIRateLimiter::reportFailure(QNetworkReply *reply)
+{
+    Q_D(APIRateLimiter);
+
+    if(!reply) return;
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    QJsonObject errorObj = QJsonDocument::fromJson(reply->peek(reply->bytesAvailable())).object().value("error").toObject();
+    QString reason = errorObj.value("errors").toArray().at(0).toObject().value("reason").toString();
+
+    if(reason == "quotaExceeded" || reason == "dailyLimitExceeded")
+    {
+        QDateTime now = QDateTime::currentDateTime().toTimeZone(quotaTimeZone());
+        d->pausedUntil = QDateTime(now.date().addDays(1), QTime(0, 0), quotaTimeZone()).toMSecsSinceEpoch();
+        d->quotaUsed = d->quotaLimit;
+
+        qDebug() << "Youtube API quota exceeded, pausing until" << QDateTime::fromMSecsSinceEpoch(d->pausedUntil);
+
+        emit usageChanged();
+        return;
+    }
+
+    bool transient = status == 429 || status >= 500 || reason == "rateLimitExceeded" || reason == "userRateLimitExceeded" ||
+            reply->error() == QNetworkReply::OperationCanceledError || reply->error() == QNetworkReply::TimeoutError ||
+            reply->error() == QNetworkReply::TemporaryNetworkFailureError;
+
+    if(!transient) return;
+
+    //Exponential backoff with jitter so retries from different paths do not line up
+    int delay = BACKOFF_BASE_DELAY << qMin(d->failures, 16);
+    delay = qMin(delay, BACKOFF_MAXIMUM_DELAY);
+    delay += qrand() % (delay / 2 + 1);
+    ++d->failures;
+
+    d->backoffUntil = QDateTime::currentMSecsSinceEpoch() + delay;
+
+    emit usageChanged();
+}
+
+int APIRateLimiter::quotaUsed() const
+{
+    Q_D(const APIRateLimiter);
+    return d->quotaUsed;
+}
+
+int APIRateLimiter::quotaLimit() const
+{
+    Q_D(const APIRateLimiter);
+    return d->quotaLimit;
+}
+
+int APIRateLimiter::tokens()
+{
+    Q_D(APIRateLimiter);
+
+    d->refill();
+    return int(d->tokens);
+}
+
+bool APIRateLimiter::quotaExceeded()
+{
+    Q_D(APIRateLimiter);
+
+    if(!d->pausedUntil) return false;
+
+    if(QDateTime::currentMSecsSinceEpoch() >= d->pausedUntil)
+    {
+        d->pausedUntil = 0;
+        return false;
+    }
+
+    return true;
+}
+
+int APIRateLimiter::backoffDelay() const
+{
+    Q_D(const APIRateLimiter);
+    return qMax(qint64(0), d->backoffUntil - QDateTime::currentMSecsSinceEpoch());
+}
+
+int APIRateLimiter::retryDelay() const
+{
+    Q_D(const APIRateLimiter);
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 delay = qMax(d->backoffUntil, d->pausedUntil) - now;
+
+    //Wait at least until the bucket holds enough for another search
+    if(d->tokens < SEARCH_QUOTA_COST && d->refillRate > 0)
+    {
+        delay = qMax(delay, qint64((SEARCH_QUOTA_COST - d->tokens) * 60000 / d->refillRate));
+    }
+
+    return int(qBound(qint64(BACKOFF_BASE_DELAY), delay, qint64(24 * 60 * 60 * 1000)));
+}
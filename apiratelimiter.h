@@ -0,0 +1,74 @@
+#ifndef APIRATELIMITER_H
+#define APIRATELIMITER_H
+
+#include <QObject>
+#include <QtQml>
+
+class QNetworkReply;
+
+class APIRateLimiterPrivate;
+class APIRateLimiter : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int quotaUsed READ quotaUsed NOTIFY usageChanged)
+    Q_PROPERTY(int quotaLimit READ quotaLimit NOTIFY usageChanged)
+    Q_PROPERTY(int tokens READ tokens NOTIFY usageChanged)
+    Q_PROPERTY(bool quotaExceeded READ quotaExceeded NOTIFY usageChanged)
+    Q_PROPERTY(int backoffDelay READ backoffDelay NOTIFY usageChanged)
+
+public:
+    enum Endpoint
+    {
+        ENDPOINT_SEARCH,
+        ENDPOINT_VIDEOS
+    };
+
+    enum Priority
+    {
+        PRIORITY_ESSENTIAL,
+        PRIORITY_BACKGROUND
+    };
+
+    static APIRateLimiter* singleton();
+    static void declareQML();
+
+    static int cost(const Endpoint& endpoint);
+
+    bool acquire(const Endpoint& endpoint, const Priority& priority);
+    bool canAcquire(const Endpoint& endpoint, const Priority& priority);
+
+    void reportSuccess();
+    void reportFailure(QNetworkReply *reply);
+
+    int quotaUsed() const;
+    int quotaLimit() const;
+    int tokens();
+    bool quotaExceeded();
+    int backoffDelay() const;
+
+    Q_INVOKABLE int retryDelay() const;
+
+signals:
+    void usageChanged();
+
+private:
+    explicit APIRateLimiter(QObject *parent = 0);
+    virtual ~APIRateLimiter();
+
+    static APIRateLimiter *_singleton;
+
+    Q_DECLARE_PRIVATE(APIRateLimiter)
+    APIRateLimiterPrivate * const d_ptr;
+
+};
+
+static QObject *qmlAPIRateLimiterSingleton(QQmlEngine *engine, QJSEngine *scriptEngine)
+{
+    Q_UNUSED(engine)
+    Q_UNUSED(scriptEngine)
+
+    return APIRateLimiter::singleton();
+}
+
+#endif // APIRATELIMITER_H
@@ -1,6 +1,7 @@
 #include "applicationmanager.h"
 #include "youtubeapimanager.h"
 #include "usermanager.h"
+#include "deadlinescheduler.h"
 
 #include <QtWidgets/QApplication>
 #include <QDesktopServices>
@@ -270,6 +271,7 @@ void ApplicationManager::loadConfiguration()
     QUrl url(ApplicationManager::singleton()->beatwhaleAPIUrl() + "configuration.php");
     QNetworkReply *reply = d->networkManager->get(QNetworkRequest(url));
     connect(reply, SIGNAL(finished()), SLOT(loadConfigurationReply()));
+    DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_CONFIGURATION);
 }
 
 void ApplicationManager::loadConfigurationReply()
@@ -283,7 +285,7 @@ void ApplicationManager::loadConfigurationReply()
     QJsonDocument document = QJsonDocument::fromJson(replyBA);
     QJsonObject obj = document.object();
 
-    delete reply;
+    reply->deleteLater();
 
     QString dbHost = obj.value("db_host").toString();
     QString youtubeAPIKey = obj.value("youtube_api_key").toString();
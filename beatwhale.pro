@@ -128,7 +128,15 @@ SOURCES += main.cpp \
     sslsafenetworkfactory.cpp \
     closeeventfilter.cpp \
     applicationmanager.cpp \
-    mouseeventfilter.cpp
+    mouseeventfilter.cpp \
+    searchcache.cpp \
+    videodetailsstore.cpp \
+    searchresultsmodel.cpp \
+    deadlinescheduler.cpp \
+    apiratelimiter.cpp \
+    youtubedlpool.cpp \
+    streambuffer.cpp \
+    mediacache.cpp
 
 HEADERS += \
     youtubeapimanager.h \
@@ -141,7 +149,15 @@ HEADERS += \
     sslsafenetworkfactory.h \
     closeeventfilter.h \
     applicationmanager.h \
-    mouseeventfilter.h
+    mouseeventfilter.h \
+    searchcache.h \
+    videodetailsstore.h \
+    searchresultsmodel.h \
+    deadlinescheduler.h \
+    apiratelimiter.h \
+    youtubedlpool.h \
+    streambuffer.h \
+    mediacache.h
 
 # Installation path
 # target.path =
@@ -9,14 +9,36 @@
 #include <QWindow>
 #include <QDebug>
 
+#define CLOSE_UPLOAD_TIMEOUT 3000
+
+CloseEventFilter::CloseEventFilter(QObject *parent) :
+    QObject(parent),
+    waitingForUploads(false)
+{
+}
+
 bool CloseEventFilter::eventFilter(QObject *obj, QEvent *event)
 {
     if(event->type() == QEvent::Close)
     {
-        UserManager::singleton()->stopListeningToChanges();
+        //Another close request while the uploads finish changes nothing
+        if(waitingForUploads) return true;
+
         ApplicationManager::singleton()->saveWindowData();
-        QApplication::instance()->quit();
-//        QTimer::singleShot(200, this, SLOT(closeApplication()));
+
+        //Library edits still buffered are written before quitting, waiting a few seconds at most
+        if(UserManager::singleton()->flushDocuments())
+        {
+            QWindow *window = qobject_cast<QWindow*>(obj);
+            if(window) window->hide();
+
+            waitingForUploads = true;
+            connect(UserManager::singleton(), SIGNAL(uploadsFinished()), SLOT(closeApplication()), Qt::UniqueConnection);
+            QTimer::singleShot(CLOSE_UPLOAD_TIMEOUT, this, SLOT(closeApplication()));
+            return true;
+        }
+
+        closeApplication();
         return true;
     }
     else
@@ -28,6 +50,6 @@ bool CloseEventFilter::eventFilter(QObject *obj, QEvent *event)
 void CloseEventFilter::closeApplication()
 {
     qDebug() << "Safe exit";
-    //QApplication::instance()->quit();
-    //exit(0);
+    UserManager::singleton()->stopListeningToChanges();
+    QApplication::instance()->quit();
 }
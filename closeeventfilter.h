@@ -7,11 +7,17 @@ class CloseEventFilter : public QObject
  {
     Q_OBJECT
 
+public:
+    explicit CloseEventFilter(QObject *parent = 0);
+
 public slots:
     void closeApplication();
 
 protected:
     bool eventFilter(QObject *obj, QEvent *event);
+
+private:
+    bool waitingForUploads;
 };
 
 #endif // CLOSEEVENTFILTER_H
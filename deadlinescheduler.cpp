@@ -0,0 +1,193 @@
+#include "deadlinescheduler.h"
+
+#include <QNetworkReply>
+#include <QProcess>
+#include <QSettings>
+#include <QTimer>
+#include <QVector>
+#include <QSet>
+
+#define WHEEL_SLOTS 64
+#define TICK_INTERVAL 250
+
+DeadlineScheduler *DeadlineScheduler::_singleton = 0;
+
+struct DeadlineEntry
+{
+    DeadlineEntry() : slot(0), rounds(0) {}
+
+    int slot;
+    int rounds;
+};
+
+class DeadlineSchedulerPrivate
+{
+public:
+    DeadlineSchedulerPrivate() :
+        timer(0),
+        currentSlot(0)
+    {
+        wheel.resize(WHEEL_SLOTS);
+
+        QSettings settings("beatwhale_config.ini", QSettings::IniFormat);
+        deadlines.insert(DeadlineScheduler::REQUEST_SEARCH, settings.value("deadline_search", 20000).toInt());
+        deadlines.insert(DeadlineScheduler::REQUEST_VIDEOS, settings.value("deadline_videos", 20000).toInt());
+        deadlines.insert(DeadlineScheduler::REQUEST_SUGGESTION, settings.value("deadline_suggestion", 20000).toInt());
+        deadlines.insert(DeadlineScheduler::REQUEST_ACCOUNT, settings.value("deadline_account", 30000).toInt());
+        deadlines.insert(DeadlineScheduler::REQUEST_CONFIGURATION, settings.value("deadline_configuration", 10000).toInt());
+        deadlines.insert(DeadlineScheduler::REQUEST_PROCESS, settings.value("deadline_process", 30000).toInt());
+    }
+
+    virtual ~DeadlineSchedulerPrivate()
+    {
+    }
+
+    void remove(QObject *object)
+    {
+        DeadlineEntry entry = entries.take(object);
+        wheel[entry.slot].remove(object);
+    }
+
+    QTimer *timer;
+    int currentSlot;
+
+    //Each slot holds the objects expiring when the wheel reaches it, rounds counts the extra laps
+    QVector<QSet<QObject*> > wheel;
+    QHash<QObject*, DeadlineEntry> entries;
+    QHash<int, int> deadlines;
+};
+
+DeadlineScheduler::DeadlineScheduler(QObject *parent) :
+    QObject(parent),
+    d_ptr(new DeadlineSchedulerPrivate)
+{
+    Q_D(DeadlineScheduler);
+
+    d->timer = new QTimer(this);
+    d->timer->setInterval(TICK_INTERVAL);
+    connect(d->timer, SIGNAL(timeout()), SLOT(tick()));
+}
+
+DeadlineScheduler::~DeadlineScheduler()
+{
+    delete d_ptr;
+}
+
+DeadlineScheduler *DeadlineScheduler::singleton()
+{
+    if(!_singleton)
+    {
+        _singleton = new DeadlineScheduler;
+    }
+    return _singleton;
+}
+
+int DeadlineScheduler::deadline(const RequestType &type) const
+{
+    Q_D(const DeadlineScheduler);
+    return d->deadlines.value(type);
+}
+
+void DeadlineScheduler::setDeadline(const RequestType &type, const int &msecs)
+{
+    Q_D(DeadlineScheduler);
+    d->deadlines.insert(type, msecs);
+}
+
+void DeadlineScheduler::schedule(QObject *object, const RequestType &type)
+{
+    Q_D(DeadlineScheduler);
+    schedule(object, d->deadlines.value(type));
+}
+
+void DeadlineScheduler::schedule(QObject *object, const int &msecs)
+{
+    Q_D(DeadlineScheduler);
+
+    if(!object) return;
+
+    if(d->entries.contains(object)) d->remove(object);
+    else connect(object, SIGNAL(destroyed(QObject*)), SLOT(objectDestroyed(QObject*)));
+
+    int ticks = qMax(1, (msecs + TICK_INTERVAL - 1) / TICK_INTERVAL);
+
+    DeadlineEntry entry;
+    entry.slot = (d->currentSlot + ticks) % WHEEL_SLOTS;
+    entry.rounds = (ticks - 1) / WHEEL_SLOTS;
+
+    d->entries.insert(object, entry);
+    d->wheel[entry.slot].insert(object);
+
+    if(!d->timer->isActive()) d->timer->start();
+
+    emit countChanged(d->entries.count());
+}
+
+void DeadlineScheduler::cancel(QObject *object)
+{
+    Q_D(DeadlineScheduler);
+
+    if(!d->entries.contains(object)) return;
+
+    d->remove(object);
+    disconnect(object, SIGNAL(destroyed(QObject*)), this, SLOT(objectDestroyed(QObject*)));
+
+    if(d->entries.isEmpty()) d->timer->stop();
+
+    emit countChanged(d->entries.count());
+}
+
+bool DeadlineScheduler::isScheduled(QObject *object) const
+{
+    Q_D(const DeadlineScheduler);
+    return d->entries.contains(object);
+}
+
+int DeadlineScheduler::count() const
+{
+    Q_D(const DeadlineScheduler);
+    return d->entries.count();
+}
+
+void DeadlineScheduler::tick()
+{
+    Q_D(DeadlineScheduler);
+
+    d->currentSlot = (d->currentSlot + 1) % WHEEL_SLOTS;
+
+    QList<QObject*> expiredObjects;
+    foreach(QObject *object, d->wheel.at(d->currentSlot))
+    {
+        DeadlineEntry& entry = d->entries[object];
+        if(entry.rounds > 0)
+        {
+            --entry.rounds;
+            continue;
+        }
+
+        expiredObjects.append(object);
+    }
+
+    foreach(QObject *object, expiredObjects)
+    {
+        cancel(object);
+
+        //Aborting is queued so the object is not destroyed by its own handlers while still inside abort()
+        if(qobject_cast<QNetworkReply*>(object)) QMetaObject::invokeMethod(object, "abort", Qt::QueuedConnection);
+        else if(qobject_cast<QProcess*>(object)) QMetaObject::invokeMethod(object, "kill", Qt::QueuedConnection);
+
+        emit expired(object);
+    }
+}
+
+void DeadlineScheduler::objectDestroyed(QObject *object)
+{
+    Q_D(DeadlineScheduler);
+
+    if(!d->entries.contains(object)) return;
+
+    d->remove(object);
+    if(d->entries.isEmpty()) d->timer->stop();
+
+    emit countChanged(d->entries.count());
+}
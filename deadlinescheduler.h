@@ -0,0 +1,55 @@
+#ifndef DEADLINESCHEDULER_H
+#define DEADLINESCHEDULER_H
+
+#include <QObject>
+
+class DeadlineSchedulerPrivate;
+class DeadlineScheduler : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+
+public:
+    enum RequestType
+    {
+        REQUEST_SEARCH,
+        REQUEST_VIDEOS,
+        REQUEST_SUGGESTION,
+        REQUEST_ACCOUNT,
+        REQUEST_CONFIGURATION,
+        REQUEST_PROCESS
+    };
+
+    static DeadlineScheduler* singleton();
+
+    int deadline(const RequestType& type) const;
+    void setDeadline(const RequestType& type, const int& msecs);
+
+    void schedule(QObject *object, const RequestType& type);
+    void schedule(QObject *object, const int& msecs);
+    void cancel(QObject *object);
+    bool isScheduled(QObject *object) const;
+
+    int count() const;
+
+signals:
+    void expired(QObject *object);
+    void countChanged(const int& count);
+
+private slots:
+    void tick();
+    void objectDestroyed(QObject *object);
+
+private:
+    explicit DeadlineScheduler(QObject *parent = 0);
+    virtual ~DeadlineScheduler();
+
+    static DeadlineScheduler *_singleton;
+
+    Q_DECLARE_PRIVATE(DeadlineScheduler)
+    DeadlineSchedulerPrivate * const d_ptr;
+
+};
+
+#endif // DEADLINESCHEDULER_H
@@ -11,6 +11,10 @@
 #include "playlistsmanager.h"
 #include "videoitem.h"
 #include "playlist.h"
+#include "searchresultsmodel.h"
+#include "apiratelimiter.h"
+#include "streambuffer.h"
+#include "mediacache.h"
 #include "sslsafenetworkfactory.h"
 #include "closeeventfilter.h"
 #include "mouseeventfilter.h"
@@ -65,6 +69,10 @@ int main(int argc, char *argv[])
     PlaylistsManager::declareQML();
     VideoItem::declareQML();
     Playlist::declareQML();
+    SearchResultsModel::declareQML();
+    APIRateLimiter::declareQML();
+    StreamBuffer::declareQML();
+    MediaCache::declareQML();
 
     Components::initResources();
 
@@ -0,0 +1,524 @@
+#include "mediacache.h"
+#include "playlistsmanager.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSettings>
+#include <QQueue>
+#include <QTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+#define INDEX_SAVE_DELAY 5000
+
+MediaCache *MediaCache::_singleton = 0;
+
+struct MediaCacheEntry
+{
+    MediaCacheEntry() : accessed(0), size(0) {}
+
+    QString format;
+    QString extension;
+    qint64 accessed;
+    qint64 size;
+};
+
+struct MediaDownload
+{
+    QString videoID;
+    QString format;
+    QString extension;
+    QString url;
+};
+
+class MediaCachePrivate
+{
+public:
+    MediaCachePrivate() :
+        enabled(false),
+        maximumSize(qint64(1024) * 1024 * 1024),
+        size(0),
+        hits(0),
+        misses(0),
+        indexDirty(false),
+        saveTimer(0),
+        networkManager(0),
+        reply(0),
+        file(0)
+    {
+        QSettings localSettings(QSettings::IniFormat, QSettings::UserScope, "BeatWhale", "beatwhale_app");
+        QSettings settings("beatwhale_config.ini", QSettings::IniFormat);
+
+        path = QFileInfo(localSettings.fileName()).path() + "/cache/media";
+        enabled = localSettings.value("media_cache_enabled", settings.value("media_cache_enabled", enabled)).toBool();
+        maximumSize = settings.value("media_cache_size", maximumSize).toLongLong();
+    }
+
+    virtual ~MediaCachePrivate()
+    {
+        delete file;
+    }
+
+    QString filePath(const QString& videoID, const MediaCacheEntry& entry) const
+    {
+        return path + "/" + videoID + "." + entry.format + "." + entry.extension;
+    }
+
+    QString indexPath() const
+    {
+        return path + "/index.json";
+    }
+
+    void loadIndex()
+    {
+        QFile indexFile(indexPath());
+        if(!indexFile.open(QFile::ReadOnly)) return;
+
+        QJsonObject indexObj = QJsonDocument::fromJson(indexFile.readAll()).object();
+        foreach(QString videoID, indexObj.keys())
+        {
+            QJsonObject entryObj = indexObj.value(videoID).toObject();
+
+            MediaCacheEntry entry;
+            entry.format = entryObj.value("format").toString();
+            entry.extension = entryObj.value("extension").toString();
+            entry.accessed = entryObj.value("accessed").toVariant().toLongLong();
+            entry.size = entryObj.value("size").toVariant().toLongLong();
+
+            if(QFileInfo(filePath(videoID, entry)).size() != entry.size) continue;
+
+            entries.insert(videoID, entry);
+            size += entry.size;
+        }
+    }
+
+    void saveIndex()
+    {
+        if(!indexDirty) return;
+
+        QJsonObject indexObj;
+        foreach(QString videoID, entries.keys())
+        {
+            const MediaCacheEntry& entry = entries[videoID];
+
+            QJsonObject entryObj;
+            entryObj.insert("format", entry.format);
+            entryObj.insert("extension", entry.extension);
+            entryObj.insert("accessed", QString::number(entry.accessed));
+            entryObj.insert("size", QString::number(entry.size));
+            indexObj.insert(videoID, entryObj);
+        }
+
+        QSaveFile indexFile(indexPath());
+        if(!indexFile.open(QFile::WriteOnly)) return;
+        indexFile.write(QJsonDocument(indexObj).toJson(QJsonDocument::Compact));
+        if(indexFile.commit()) indexDirty = false;
+    }
+
+    void remove(const QString& videoID)
+    {
+        if(!entries.contains(videoID)) return;
+
+        QFile::remove(filePath(videoID, entries.value(videoID)));
+        size -= entries.value(videoID).size;
+        entries.remove(videoID);
+        indexDirty = true;
+    }
+
+    void evict()
+    {
+        //Favorites are pinned, only when nothing else is left over the budget do they go too
+        bool pinned = true;
+
+        while(size > maximumSize && !entries.isEmpty())
+        {
+            QString leastRecentID;
+            qint64 leastRecentAccess = 0;
+
+            QHash<QString, MediaCacheEntry>::const_iterator it = entries.constBegin();
+            for(; it != entries.constEnd(); ++it)
+            {
+                if(pinned && PlaylistsManager::singleton()->isFavorited(it.key())) continue;
+
+                if(leastRecentID.isEmpty() || it.value().accessed < leastRecentAccess)
+                {
+                    leastRecentID = it.key();
+                    leastRecentAccess = it.value().accessed;
+                }
+            }
+
+            if(leastRecentID.isEmpty())
+            {
+                pinned = false;
+                continue;
+            }
+
+            remove(leastRecentID);
+        }
+    }
+
+    QString path;
+
+    bool enabled;
+    qint64 maximumSize;
+    qint64 size;
+
+    int hits;
+    int misses;
+
+    bool indexDirty;
+    QTimer *saveTimer;
+    QHash<QString, MediaCacheEntry> entries;
+
+    QNetworkAccessManager *networkManager;
+    QQueue<MediaDownload> downloads;
+    MediaDownload download;
+    QNetworkReply *reply;
+    QFile *file;
+};
+
+MediaCache::MediaCache(QObject *parent) :
+    QObject(parent),
+    d_ptr(new MediaCachePrivate)
+{
+    Q_D(MediaCache);
+
+    d->networkManager = new QNetworkAccessManager(this);
+
+    //Access times change on every hit, they are written out together
+    d->saveTimer = new QTimer(this);
+    d->saveTimer->setSingleShot(true);
+    d->saveTimer->setInterval(INDEX_SAVE_DELAY);
+    connect(d->saveTimer, SIGNAL(timeout()), SLOT(saveIndex()));
+
+    if(QCoreApplication::instance()) connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), SLOT(saveIndex()));
+
+    QDir().mkpath(d->path);
+    d->loadIndex();
+
+    //Interrupted downloads are not resumed
+    foreach(QString partPath, QDir(d->path).entryList(QStringList() << "*.part", QDir::Files))
+    {
+        QFile::remove(d->path + "/" + partPath);
+    }
+}
+
+MediaCache::~MediaCache()
+{
+    Q_D(MediaCache);
+    d->saveIndex();
+    delete d_ptr;
+}
+
+MediaCache *MediaCache::singleton()
+{
+    if(!_singleton)
+    {
+        _singleton = new MediaCache;
+    }
+    return _singleton;
+}
+
+void MediaCache::declareQML()
+{
+    qmlRegisterSingletonType<MediaCache>("BeatWhaleAPI", 1, 0, "MediaCache", qmlMediaCacheSingleton);
+}
+
+//Audio only formats are a fraction of the video size and all the player needs for music
+QVariantMap MediaCache::audioFormat(const QVariantList &formats)
+{
+    QVariantMap bestFormat;
+
+    foreach(QVariant formatVariant, formats)
+    {
+        QVariantMap format = formatVariant.toMap();
+        if(format.value("videoCodec").toString() != "none" || format.value("audioCodec").toString() == "none") continue;
+        if(format.value("url").toString().isEmpty()) continue;
+
+        if(bestFormat.isEmpty() || format.value("bitrate").toDouble() > bestFormat.value("bitrate").toDouble())
+        {
+            bestFormat = format;
+        }
+    }
+
+    return bestFormat;
+}
+
+bool MediaCache::isEnabled() const
+{
+    Q_D(const MediaCache);
+    return d->enabled;
+}
+
+void MediaCache::setEnabled(const bool &enabled)
+{
+    Q_D(MediaCache);
+
+    if(d->enabled == enabled) return;
+    d->enabled = enabled;
+
+    QSettings localSettings(QSettings::IniFormat, QSettings::UserScope, "BeatWhale", "beatwhale_app");
+    localSettings.setValue("media_cache_enabled", enabled);
+
+    if(!enabled) d->downloads.clear();
+
+    emit statisticsChanged();
+}
+
+qint64 MediaCache::maximumSize() const
+{
+    Q_D(const MediaCache);
+    return d->maximumSize;
+}
+
+void MediaCache::setMaximumSize(const qint64 &bytes)
+{
+    Q_D(MediaCache);
+
+    d->maximumSize = bytes;
+    d->evict();
+    d->saveIndex();
+
+    emit statisticsChanged();
+}
+
+bool MediaCache::contains(const QString &videoID) const
+{
+    Q_D(const MediaCache);
+    return d->enabled && d->entries.contains(videoID);
+}
+
+bool MediaCache::wants(const QString &videoID) const
+{
+    Q_D(const MediaCache);
+
+    if(!d->enabled || videoID.isEmpty() || d->entries.contains(videoID)) return false;
+    if(d->download.videoID == videoID) return false;
+
+    foreach(MediaDownload download, d->downloads)
+    {
+        if(download.videoID == videoID) return false;
+    }
+
+    //Only what the user keeps coming back to is worth the disk space
+    return PlaylistsManager::singleton()->isFavorited(videoID) || !PlaylistsManager::singleton()->itemPlaylists(videoID, QString()).isEmpty();
+}
+
+QString MediaCache::file(const QString &videoID)
+{
+    Q_D(MediaCache);
+
+    if(!d->enabled) return QString();
+
+    QString filePath;
+    if(d->entries.contains(videoID))
+    {
+        filePath = d->filePath(videoID, d->entries.value(videoID));
+
+        if(!QFile::exists(filePath))
+        {
+            d->remove(videoID);
+            filePath.clear();
+        }
+        else
+        {
+            d->entries[videoID].accessed = QDateTime::currentMSecsSinceEpoch();
+            d->indexDirty = true;
+            if(!d->saveTimer->isActive()) d->saveTimer->start();
+        }
+    }
+
+    if(filePath.isEmpty()) ++d->misses;
+    else ++d->hits;
+
+    emit statisticsChanged();
+    return filePath;
+}
+
+void MediaCache::store(const QString &videoID, const QString &format, const QString &extension, const QString &url)
+{
+    Q_D(MediaCache);
+
+    if(!d->enabled || videoID.isEmpty() || url.isEmpty()) return;
+
+    MediaDownload download;
+    download.videoID = videoID;
+    download.format = format;
+    download.extension = extension.isEmpty() ? "media" : extension;
+    download.url = url;
+    d->downloads.enqueue(download);
+
+    startDownload();
+
+    emit statisticsChanged();
+}
+
+void MediaCache::clear()
+{
+    Q_D(MediaCache);
+
+    foreach(QString videoID, d->entries.keys())
+    {
+        d->remove(videoID);
+    }
+    d->saveIndex();
+
+    emit statisticsChanged();
+}
+
+void MediaCache::saveIndex()
+{
+    Q_D(MediaCache);
+
+    d->saveTimer->stop();
+    d->saveIndex();
+}
+
+qint64 MediaCache::size() const
+{
+    Q_D(const MediaCache);
+    return d->size;
+}
+
+int MediaCache::count() const
+{
+    Q_D(const MediaCache);
+    return d->entries.count();
+}
+
+int MediaCache::hits() const
+{
+    Q_D(const MediaCache);
+    return d->hits;
+}
+
+int MediaCache::misses() const
+{
+    Q_D(const MediaCache);
+    return d->misses;
+}
+
+int MediaCache::pendingDownloads() const
+{
+    Q_D(const MediaCache);
+    return d->downloads.count() + (d->reply ? 1 : 0);
+}
+
+void MediaCache::startDownload()
+{
+    Q_D(MediaCache);
+
+    //One download at a time, the cache fills in the background without competing with playback
+    if(d->reply) return;
+
+    //An item that cannot be written is skipped, the ones queued behind it still go
+    while(!d->file)
+    {
+        if(d->downloads.isEmpty())
+        {
+            emit statisticsChanged();
+            return;
+        }
+
+        d->download = d->downloads.dequeue();
+
+        MediaCacheEntry entry;
+        entry.format = d->download.format;
+        entry.extension = d->download.extension;
+
+        d->file = new QFile(d->filePath(d->download.videoID, entry) + ".part");
+        if(d->file->open(QFile::WriteOnly | QFile::Truncate)) break;
+
+        qDebug() << "Media cache could not write" << d->file->fileName();
+
+        delete d->file;
+        d->file = 0;
+        d->download = MediaDownload();
+    }
+
+    d->reply = d->networkManager->get(QNetworkRequest(QUrl(d->download.url)));
+    connect(d->reply, SIGNAL(readyRead()), SLOT(downloadReadyRead()));
+    connect(d->reply, SIGNAL(finished()), SLOT(downloadFinished()));
+}
+
+void MediaCache::downloadReadyRead()
+{
+    Q_D(MediaCache);
+
+    if(d->reply != sender() || !d->file) return;
+
+    int status = d->reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if(status != 200) return;
+
+    d->file->write(d->reply->readAll());
+}
+
+void MediaCache::downloadFinished()
+{
+    Q_D(MediaCache);
+
+    if(d->reply != sender()) return;
+
+    QNetworkReply *reply = d->reply;
+    d->reply = 0;
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const bool success = reply->error() == QNetworkReply::NoError && status == 200;
+    if(success) d->file->write(reply->readAll());
+
+    reply->deleteLater();
+
+    QString partPath = d->file->fileName();
+    d->file->close();
+    delete d->file;
+    d->file = 0;
+
+    MediaCacheEntry entry;
+    entry.format = d->download.format;
+    entry.extension = d->download.extension;
+    entry.accessed = QDateTime::currentMSecsSinceEpoch();
+    entry.size = QFileInfo(partPath).size();
+
+    QString videoID = d->download.videoID;
+    QString filePath = d->filePath(videoID, entry);
+    d->download = MediaDownload();
+
+    if(!success || !entry.size || !d->enabled)
+    {
+        qDebug() << "Media cache could not download" << videoID << reply->errorString();
+        QFile::remove(partPath);
+    }
+    else
+    {
+        d->remove(videoID);
+        QFile::remove(filePath);
+
+        if(QFile::rename(partPath, filePath))
+        {
+            d->entries.insert(videoID, entry);
+            d->size += entry.size;
+            d->indexDirty = true;
+
+            d->evict();
+            d->saveIndex();
+
+            if(d->entries.contains(videoID)) emit stored(videoID);
+        }
+        else
+        {
+            QFile::remove(partPath);
+        }
+    }
+
+    startDownload();
+
+    emit statisticsChanged();
+}
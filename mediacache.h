@@ -0,0 +1,77 @@
+#ifndef MEDIACACHE_H
+#define MEDIACACHE_H
+
+#include <QObject>
+#include <QVariantMap>
+#include <QtQml>
+
+class MediaCachePrivate;
+class MediaCache : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(bool enabled READ isEnabled WRITE setEnabled NOTIFY statisticsChanged)
+    Q_PROPERTY(qint64 maximumSize READ maximumSize WRITE setMaximumSize NOTIFY statisticsChanged)
+    Q_PROPERTY(qint64 size READ size NOTIFY statisticsChanged)
+    Q_PROPERTY(int count READ count NOTIFY statisticsChanged)
+    Q_PROPERTY(int hits READ hits NOTIFY statisticsChanged)
+    Q_PROPERTY(int misses READ misses NOTIFY statisticsChanged)
+    Q_PROPERTY(int pendingDownloads READ pendingDownloads NOTIFY statisticsChanged)
+
+public:
+    static MediaCache* singleton();
+    static void declareQML();
+
+    static QVariantMap audioFormat(const QVariantList& formats);
+
+    bool isEnabled() const;
+    Q_INVOKABLE void setEnabled(const bool& enabled);
+
+    qint64 maximumSize() const;
+    void setMaximumSize(const qint64& bytes);
+
+    Q_INVOKABLE bool contains(const QString& videoID) const;
+    bool wants(const QString& videoID) const;
+    QString file(const QString& videoID);
+    void store(const QString& videoID, const QString& format, const QString& extension, const QString& url);
+    Q_INVOKABLE void clear();
+
+    qint64 size() const;
+    int count() const;
+    int hits() const;
+    int misses() const;
+    int pendingDownloads() const;
+
+signals:
+    void statisticsChanged();
+    void stored(const QString& videoID);
+
+public slots:
+    void saveIndex();
+
+private slots:
+    void downloadReadyRead();
+    void downloadFinished();
+
+private:
+    explicit MediaCache(QObject *parent = 0);
+    virtual ~MediaCache();
+
+    void startDownload();
+
+    static MediaCache *_singleton;
+
+    Q_DECLARE_PRIVATE(MediaCache)
+    MediaCachePrivate * const d_ptr;
+
+};
+
+static QObject *qmlMediaCacheSingleton(QQmlEngine *engine, QJSEngine *scriptEngine)
+{
+    Q_UNUSED(engine)
+    Q_UNUSED(scriptEngine)
+
+    return MediaCache::singleton();
+}
+
+#endif // MEDIACACHE_H
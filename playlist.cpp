@@ -2,16 +2,20 @@
 #include "videoitem.h"
 #include "playlistsmanager.h"
 #include "applicationmanager.h"
+#include "videodetailsstore.h"
+#include "youtubeapimanager.h"
 
 #include <QtQml>
 #include <QMap>
+#include <QTimer>
 #include <QDebug>
 
 class PlaylistPrivate
 {
 public:
     PlaylistPrivate() :
-        name("Unnamed Playlist")
+        name("Unnamed Playlist"),
+        changeQueued(false)
     {}
 
     virtual ~PlaylistPrivate()
@@ -24,6 +28,7 @@ public:
 
     QString name;
     QMap<QString,VideoItem*> videoItems;
+    bool changeQueued;
 };
 
 Playlist::Playlist(QObject *parent) :
@@ -85,6 +90,9 @@ void Playlist::addItem(const QString &id, const QString &title, const QString &s
     videoItem->setTimestamp(timestamp);
     d->videoItems.insert(id, videoItem);
 
+    VideoDetailsStore::singleton()->insert(id, QString(), thumbnail, duration);
+    if(duration.isEmpty()) YoutubeAPIManager::singleton()->videoDuration(id);
+
     QString message;
     if(!videoItem->subTitle().isEmpty()) message = "Added " + videoItem->title() + " - " + videoItem->subTitle() + " to playlist " + d->name;
     else message = "Added " + videoItem->title() + " to playlist " + d->name;
@@ -118,6 +126,9 @@ void Playlist::addItems(const QStringList &ids, const QStringList &titles, const
         videoItem->setTimestamp(timestamp);
         d->videoItems.insert(ids.at(i), videoItem);
 
+        VideoDetailsStore::singleton()->insert(ids.at(i), QString(), thumbnails.at(i), durations.at(i));
+        if(durations.at(i).isEmpty()) YoutubeAPIManager::singleton()->videoDuration(ids.at(i));
+
         videoItems.append(videoItem);
         ++count;
     }
@@ -138,6 +149,32 @@ void Playlist::addItems(const QStringList &ids, const QStringList &titles, const
     emit playlistChanged();
 }
 
+bool Playlist::setItemDuration(const QString &id, const QString &duration)
+{
+    Q_D(Playlist);
+
+    VideoItem *videoItem = d->videoItems.value(id, 0);
+    if(!videoItem || !videoItem->duration().isEmpty() || duration.isEmpty()) return false;
+
+    videoItem->setDuration(duration);
+
+    //A batch of durations arrives at once, the views are refreshed a single time for it
+    if(!d->changeQueued)
+    {
+        d->changeQueued = true;
+        QTimer::singleShot(0, this, SLOT(emitPlaylistChanged()));
+    }
+    return true;
+}
+
+void Playlist::emitPlaylistChanged()
+{
+    Q_D(Playlist);
+
+    d->changeQueued = false;
+    emit playlistChanged();
+}
+
 bool Playlist::removeItem(const QString &id)
 {
     Q_D(Playlist);
@@ -26,6 +26,7 @@ public:
                              const QString& duration, QString timestamp = QString());
     Q_INVOKABLE void addItems(const QStringList& ids, const QStringList& titles, const QStringList& subTitles, const QStringList& thumbnails,
                              const QStringList& durations, QString timestamp = QString());
+    bool setItemDuration(const QString& id, const QString& duration);
     Q_INVOKABLE bool removeItem(const QString& id);
     Q_INVOKABLE void removeItems(const QStringList& id);
     Q_INVOKABLE QList<QObject*> items() const;
@@ -41,6 +42,9 @@ signals:
 
 public slots:
 
+private slots:
+    void emitPlaylistChanged();
+
 private:
     Q_DECLARE_PRIVATE(Playlist)
     PlaylistPrivate * const d_ptr;
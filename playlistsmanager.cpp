@@ -3,18 +3,22 @@
 #include "playlist.h"
 #include "usermanager.h"
 #include "applicationmanager.h"
+#include "videodetailsstore.h"
+#include "youtubeapimanager.h"
 
 #include <jsonhelper.h>
 
 #include <QtQml>
 #include <QUuid>
+#include <QTimer>
 
 PlaylistsManager *PlaylistsManager::_singleton = 0;
 
 class PlaylistsManagerPrivate
 {
 public:
-    PlaylistsManagerPrivate()
+    PlaylistsManagerPrivate() :
+        favoritesChangeQueued(false)
     {}
 
     virtual ~PlaylistsManagerPrivate()
@@ -34,12 +38,15 @@ public:
 
     QMap<QString,VideoItem*> favorites;
     QList<Playlist*> playlists;
+    bool favoritesChangeQueued;
 };
 
 PlaylistsManager::PlaylistsManager(QObject *parent) :
     QObject(parent),
     d_ptr(new PlaylistsManagerPrivate)
 {
+    //Items saved without a duration get it filled in once it is resolved
+    connect(YoutubeAPIManager::singleton(), SIGNAL(videoDurationSuccess(QString,QString)), SLOT(videoDurationResolved(QString,QString)));
 }
 
 PlaylistsManager::~PlaylistsManager()
@@ -76,6 +83,87 @@ void PlaylistsManager::setDocument(const QJsonDocument &document)
     d->playlistsDocument = document;
 }
 
+void PlaylistsManager::applyDocument(const QJsonDocument &document)
+{
+    Q_D(PlaylistsManager);
+
+    QJsonObject oldObj = d->playlistsDocument.object();
+    QJsonObject newObj = document.object();
+
+    //The incoming revision becomes the reference first, so the granular calls below find nothing to upload
+    d->playlistsDocument = document;
+
+    ApplicationManager::singleton()->setNotificationsEnabled(false);
+
+    if(oldObj.value("Favorites") != newObj.value("Favorites"))
+    {
+        QJsonObject favoritesObj = newObj.value("Favorites").toObject();
+
+        foreach(QString id, d->favorites.keys())
+        {
+            if(!favoritesObj.contains(id)) removeFavorite(id);
+        }
+
+        foreach(QString id, favoritesObj.keys())
+        {
+            if(d->favorites.contains(id)) continue;
+
+            QJsonObject itemObj = favoritesObj.value(id).toObject();
+            addFavorite(id, itemObj.value("title").toString(), itemObj.value("subtitle").toString(), itemObj.value("thumbnail").toString(),
+                        itemObj.value("duration").toString(), itemObj.value("timestamp").toString());
+        }
+    }
+
+    //A renamed playlist arrives as one removed and one added
+    foreach(Playlist *playlist, d->playlists)
+    {
+        if(newObj.contains(playlist->name())) continue;
+
+        d->playlists.removeAll(playlist);
+        emit playlistRemoved(playlist->name());
+        delete playlist;
+    }
+
+    foreach(QString name, newObj.keys())
+    {
+        if(name == "_id" || name == "_rev" || name == "Favorites") continue;
+
+        Playlist *playlistToUpdate = playlist(name);
+
+        if(!playlistToUpdate)
+        {
+            playlistToUpdate = new Playlist(this);
+            playlistToUpdate->setName(name);
+            addPlaylist(playlistToUpdate);
+        }
+        else if(oldObj.value(name) == newObj.value(name))
+        {
+            continue;
+        }
+
+        QJsonObject playlistObj = newObj.value(name).toObject();
+
+        QStringList removedIDs;
+        foreach(QObject *item, playlistToUpdate->items())
+        {
+            VideoItem *videoItem = qobject_cast<VideoItem*>(item);
+            if(videoItem && !playlistObj.contains(videoItem->id())) removedIDs.append(videoItem->id());
+        }
+        if(!removedIDs.isEmpty()) playlistToUpdate->removeItems(removedIDs);
+
+        foreach(QString id, playlistObj.keys())
+        {
+            if(playlistToUpdate->containsItem(id)) continue;
+
+            QJsonObject itemObj = playlistObj.value(id).toObject();
+            playlistToUpdate->addItem(id, itemObj.value("title").toString(), itemObj.value("subtitle").toString(), itemObj.value("thumbnail").toString(),
+                                      itemObj.value("duration").toString(), itemObj.value("timestamp").toString());
+        }
+    }
+
+    ApplicationManager::singleton()->setNotificationsEnabled(true);
+}
+
 bool PlaylistsManager::isFavorited(const QString& id) const
 {
     Q_D(const PlaylistsManager);
@@ -102,7 +190,7 @@ void PlaylistsManager::addFavorite(const QString &id, const QString &title, cons
         JsonHelper::modifyValue(d->playlistsDocument, "Favorites." + id + ".thumbnail", thumbnail);
         JsonHelper::modifyValue(d->playlistsDocument, "Favorites." + id + ".duration", duration);
         JsonHelper::modifyValue(d->playlistsDocument, "Favorites." + id + ".timestamp", timestamp);
-        UserManager::singleton()->updateDocument(d->playlistsDocument);
+        UserManager::singleton()->recordItemAdded("Favorites", id, d->playlistsDocument.object().value("Favorites").toObject().value(id));
     }
 
     VideoItem *videoItem = new VideoItem;
@@ -114,6 +202,9 @@ void PlaylistsManager::addFavorite(const QString &id, const QString &title, cons
     videoItem->setTimestamp(timestamp);
     d->favorites.insert(id, videoItem);
 
+    VideoDetailsStore::singleton()->insert(id, QString(), thumbnail, duration);
+    if(duration.isEmpty()) YoutubeAPIManager::singleton()->videoDuration(id);
+
     QString message;
     if(!videoItem->subTitle().isEmpty()) message = "Added item to favorites: " + videoItem->title() + " - " + videoItem->subTitle();
     else message = "Added item to favorites: " + videoItem->title();
@@ -131,7 +222,7 @@ bool PlaylistsManager::removeFavorite(const QString &id)
     if(d->playlistsDocument.object().value("Favorites").toObject().contains(id))
     {
         JsonHelper::removeKey(d->playlistsDocument, "Favorites", id);
-        UserManager::singleton()->updateDocument(d->playlistsDocument);
+        UserManager::singleton()->recordItemRemoved("Favorites", id);
     }
 
     VideoItem *videoItem = d->favorites.value(id);
@@ -158,6 +249,7 @@ void PlaylistsManager::removeFavorites(const QStringList &ids)
         if(d->playlistsDocument.object().value("Favorites").toObject().contains(id))
         {
             JsonHelper::removeKey(d->playlistsDocument, "Favorites", id);
+            UserManager::singleton()->recordItemRemoved("Favorites", id);
         }
 
         VideoItem *videoItem = d->favorites.value(id);
@@ -173,7 +265,6 @@ void PlaylistsManager::removeFavorites(const QStringList &ids)
 
         delete videoItem;
     }
-    UserManager::singleton()->updateDocument(d->playlistsDocument);
 
     if(ids.count() > 1)
     {
@@ -222,7 +313,7 @@ void PlaylistsManager::addPlaylist(Playlist *playlist)
         QJsonObject obj = d->playlistsDocument.object();
         obj.insert(playlist->name(), QJsonValue());
         d->playlistsDocument = QJsonDocument(obj);
-        UserManager::singleton()->updateDocument(d->playlistsDocument);
+        UserManager::singleton()->recordPlaylistAdded(playlist->name());
     }
 
     d->playlists.append(playlist);
@@ -254,7 +345,7 @@ Playlist *PlaylistsManager::createPlaylist(const QString& name)
     QJsonObject obj = d->playlistsDocument.object();
     obj.insert(playlist->name(), QJsonValue());
     d->playlistsDocument = QJsonDocument(obj);
-    UserManager::singleton()->updateDocument(d->playlistsDocument);
+    UserManager::singleton()->recordPlaylistAdded(playlist->name());
 
     d->playlists.append(playlist);
     emit playlistCreated(playlist->name());
@@ -280,7 +371,7 @@ bool PlaylistsManager::deletePlaylist(const QString &name)
     QJsonObject obj = d->playlistsDocument.object();
     obj.remove(playlistToRemove->name());
     d->playlistsDocument = QJsonDocument(obj);
-    UserManager::singleton()->updateDocument(d->playlistsDocument);
+    UserManager::singleton()->recordPlaylistRemoved(playlistToRemove->name());
 
     ApplicationManager::singleton()->triggerNotification("Playlist " + name + " deleted");
 
@@ -341,7 +432,7 @@ void PlaylistsManager::playlistNameChanged(const QString& name, const QString &o
     }
     d->playlistsDocument = QJsonDocument(obj);
 
-    UserManager::singleton()->updateDocument(d->playlistsDocument);
+    UserManager::singleton()->recordPlaylistRenamed(oldName, name);
 
     ApplicationManager::singleton()->triggerNotification("Playlist " + oldName + " renamed to " + name);
 
@@ -362,7 +453,7 @@ void PlaylistsManager::playlistItemAdded(VideoItem *videoItem)
     JsonHelper::modifyValue(d->playlistsDocument, playlist->name() + "." + videoItem->id() + ".thumbnail", videoItem->thumbnail());
     JsonHelper::modifyValue(d->playlistsDocument, playlist->name() + "." + videoItem->id() + ".duration", videoItem->duration());
     JsonHelper::modifyValue(d->playlistsDocument, playlist->name() + "." + videoItem->id() + ".timestamp", videoItem->timestamp());
-    UserManager::singleton()->updateDocument(d->playlistsDocument);
+    UserManager::singleton()->recordItemAdded(playlist->name(), videoItem->id(), d->playlistsDocument.object().value(playlist->name()).toObject().value(videoItem->id()));
 }
 
 void PlaylistsManager::playlistItemsAdded(QList<VideoItem *> videoItems)
@@ -374,16 +465,58 @@ void PlaylistsManager::playlistItemsAdded(QList<VideoItem *> videoItems)
 
     foreach(VideoItem *videoItem, videoItems)
     {
-        if(d->playlistsDocument.object().value(playlist->name()).toObject().contains(videoItem->id())) return;
+        if(d->playlistsDocument.object().value(playlist->name()).toObject().contains(videoItem->id())) continue;
 
         JsonHelper::modifyValue(d->playlistsDocument, playlist->name() + "." + videoItem->id() + ".title", videoItem->title());
         JsonHelper::modifyValue(d->playlistsDocument, playlist->name() + "." + videoItem->id() + ".subtitle", videoItem->subTitle());
         JsonHelper::modifyValue(d->playlistsDocument, playlist->name() + "." + videoItem->id() + ".thumbnail", videoItem->thumbnail());
         JsonHelper::modifyValue(d->playlistsDocument, playlist->name() + "." + videoItem->id() + ".duration", videoItem->duration());
         JsonHelper::modifyValue(d->playlistsDocument, playlist->name() + "." + videoItem->id() + ".timestamp", videoItem->timestamp());
+        UserManager::singleton()->recordItemAdded(playlist->name(), videoItem->id(), d->playlistsDocument.object().value(playlist->name()).toObject().value(videoItem->id()));
     }
+}
+
+void PlaylistsManager::videoDurationResolved(const QString &id, const QString &duration)
+{
+    Q_D(PlaylistsManager);
+
+    if(duration.isEmpty()) return;
+
+    VideoItem *favorite = d->favorites.value(id, 0);
+    if(favorite && favorite->duration().isEmpty())
+    {
+        favorite->setDuration(duration);
+        if(d->playlistsDocument.object().value("Favorites").toObject().contains(id))
+        {
+            JsonHelper::modifyValue(d->playlistsDocument, "Favorites." + id + ".duration", duration);
+            UserManager::singleton()->recordItemAdded("Favorites", id, d->playlistsDocument.object().value("Favorites").toObject().value(id));
+        }
 
-    UserManager::singleton()->updateDocument(d->playlistsDocument);
+        if(!d->favoritesChangeQueued)
+        {
+            d->favoritesChangeQueued = true;
+            QTimer::singleShot(0, this, SLOT(emitFavoritesChanged()));
+        }
+    }
+
+    foreach(Playlist *playlist, d->playlists)
+    {
+        if(!playlist->setItemDuration(id, duration)) continue;
+
+        if(d->playlistsDocument.object().value(playlist->name()).toObject().contains(id))
+        {
+            JsonHelper::modifyValue(d->playlistsDocument, playlist->name() + "." + id + ".duration", duration);
+            UserManager::singleton()->recordItemAdded(playlist->name(), id, d->playlistsDocument.object().value(playlist->name()).toObject().value(id));
+        }
+    }
+}
+
+void PlaylistsManager::emitFavoritesChanged()
+{
+    Q_D(PlaylistsManager);
+
+    d->favoritesChangeQueued = false;
+    emit favoritesChanged();
 }
 
 void PlaylistsManager::playlistItemRemoved(const QString &id)
@@ -396,7 +529,7 @@ void PlaylistsManager::playlistItemRemoved(const QString &id)
     if(!d->playlistsDocument.object().value(playlist->name()).toObject().contains(id)) return;
 
     JsonHelper::removeKey(d->playlistsDocument, playlist->name(), id);
-    UserManager::singleton()->updateDocument(d->playlistsDocument);
+    UserManager::singleton()->recordItemRemoved(playlist->name(), id);
 }
 
 void PlaylistsManager::playlistItemsRemoved(const QStringList &ids)
@@ -410,7 +543,6 @@ void PlaylistsManager::playlistItemsRemoved(const QStringList &ids)
     {
         if(!d->playlistsDocument.object().value(playlist->name()).toObject().contains(id)) continue;
         JsonHelper::removeKey(d->playlistsDocument, playlist->name(), id);
+        UserManager::singleton()->recordItemRemoved(playlist->name(), id);
     }
-
-    UserManager::singleton()->updateDocument(d->playlistsDocument);
 }
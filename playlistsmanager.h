@@ -18,6 +18,7 @@ public:
     static void declareQML();
 
     void setDocument(const QJsonDocument& document);
+    void applyDocument(const QJsonDocument& document);
 
     Q_INVOKABLE bool isFavorited(const QString &id) const;
     Q_INVOKABLE void addFavorite(const QString& id, const QString& title, const QString& subTitle, const QString& thumbnail, const QString &duration, QString timestamp = QString());
@@ -52,6 +53,9 @@ protected slots:
     void playlistItemRemoved(const QString& id);
     void playlistItemsRemoved(const QStringList& ids);
 
+    void videoDurationResolved(const QString& id, const QString& duration);
+    void emitFavoritesChanged();
+
 protected:
 
 private:
@@ -18,6 +18,20 @@ Rectangle {
     property bool suggestionRequested: false
     property bool playingQueueMinEnabled: false
     property var shuffleList: new Array
+    property int nextShuffleVideo: -1
+    property int videoUrlToken: 0
+    property double playRequestedTime: 0
+    property bool videoStreamPlaying: true
+    property bool videoStreamRequested: false
+    property int resumeTime: 0
+    property VlcPlayer mediaPlayer: playerA
+    property VlcPlayer standbyPlayer: playerB
+    property int standbyVideoIndex: -1
+    property string standbyVideoID: ""
+    property bool standbyWithVideo: false
+    property bool standbyReady: false
+    property string failedStandbyID: ""
+    property real crossfadeProgress: 1
 
     signal loggedOut()
 
@@ -36,7 +50,7 @@ Rectangle {
         fullscreenControlsBar.repeat = repeatEnabled
     }
 
-    function playVideo(index) {
+    function playVideo(index, crossfade) {
         if(playingModel.count <= index || index < 0) return
 
         controlsBar.reset()
@@ -44,8 +58,24 @@ Rectangle {
 
         var element = playingModel.get(index)
 
-        mediaPlayer.stop()
-        YoutubeAPI.videoUrl(element.id)
+        videoStreamRequested = false
+        resumeTime = 0
+        failedStandbyID = ""
+
+        //The standby player already holds this track paused at its start
+        var swapped = standbyReady && index === standbyVideoIndex && element.id === standbyVideoID
+        if(swapped) {
+            swapPlayers(crossfade === true)
+            YoutubeAPI.prerolledVideoPlayed(element.id)
+            preresolveNextVideo()
+        }
+        else {
+            resetStandby()
+            mediaPlayer.stop()
+            playRequestedTime = new Date().getTime()
+            videoStreamPlaying = videoStreamWanted(element.id)
+            videoUrlToken = YoutubeAPI.videoUrl(element.id, videoStreamPlaying)
+        }
 
         sideBar.currentVideoID = element.id
         sideBar.currentTitle = element.title
@@ -61,6 +91,9 @@ Rectangle {
 
         currentVideoIndex = index
 
+        //The standby stream was chosen at preroll time, a video view opened since then still gets its video
+        if(swapped && !videoStreamPlaying && videoStreamWanted(element.id)) requestVideoStream()
+
         if(tvModeEnabled && index >= playingModel.count - 1 && (!shuffleEnabled || !shuffleList.length)) {
             if(shuffleEnabled) {
                 controlsBar.shuffle = false
@@ -77,6 +110,7 @@ Rectangle {
         UserManager.removedFromQueue(index);
 
         if(playingModel.count == 0 || (index === currentVideoIndex && index >= playingModel.count)) {
+            resetStandby()
             mediaPlayer.stop()
             currentVideoIndex = -1
             return
@@ -90,23 +124,21 @@ Rectangle {
         else if(currentVideoIndex > index) --currentVideoIndex
     }
 
-    function playNextVideo() {
+    function playNextVideo(crossfade) {
         if(playingModel.count == 0) return
 
         var nextVideo, index
 
         if(shuffleEnabled) {
-            if(shuffleList.length) {
-                nextVideo = shuffleList[Math.floor((Math.random() * (shuffleList.length - 1)))];
-                index = shuffleList.indexOf(nextVideo)
-                shuffleList.splice(index, 1)
-            }
-            else {
-                generateShuffleList()
-                nextVideo = shuffleList[Math.floor((Math.random() * (shuffleList.length - 1)))];
-                index = shuffleList.indexOf(nextVideo)
-                shuffleList.splice(index, 1)
-            }
+            if(!shuffleList.length) generateShuffleList()
+
+            //Use the entry picked ahead of time, it is the one already resolved
+            if(shuffleList.indexOf(nextShuffleVideo) !== -1) nextVideo = nextShuffleVideo
+            else nextVideo = shuffleList[Math.floor((Math.random() * (shuffleList.length - 1)))];
+
+            index = shuffleList.indexOf(nextVideo)
+            shuffleList.splice(index, 1)
+            nextShuffleVideo = -1
         }
         else {
             //Check if it is the last video in queue
@@ -123,7 +155,170 @@ Rectangle {
             }
         }
 
-        playVideo(nextVideo)
+        playVideo(nextVideo, crossfade)
+    }
+
+    //Opening a video view while only the audio plays switches to the video stream at the same position
+    function requestVideoStream() {
+        if(videoStreamPlaying || videoStreamRequested || currentVideoIndex < 0) return
+        if(mediaPlayer.state != VlcPlayer.Playing && mediaPlayer.state != VlcPlayer.Paused) return
+
+        videoStreamRequested = true
+        resumeTime = mediaPlayer.time
+        videoUrlToken = YoutubeAPI.videoUrl(playingModel.get(currentVideoIndex).id, true)
+    }
+
+    function videoStreamWanted(id) {
+        return (!YoutubeAPI.audioOnly && !MediaCache.contains(id)) || videoMaximized.visible || videoFullscreen.visible
+    }
+
+    function upcomingVideo() {
+        if(playingModel.count < 2) return -1
+
+        var nextVideo = -1
+
+        if(shuffleEnabled) {
+            if(shuffleList.length) {
+                if(shuffleList.indexOf(nextShuffleVideo) === -1) nextShuffleVideo = shuffleList[Math.floor((Math.random() * (shuffleList.length - 1)))]
+                nextVideo = nextShuffleVideo
+            }
+        }
+        else if(currentVideoIndex < playingModel.count - 1) {
+            nextVideo = currentVideoIndex + 1
+        }
+        else if(repeatEnabled) {
+            nextVideo = 0
+        }
+
+        return nextVideo < playingModel.count ? nextVideo : -1
+    }
+
+    function preresolveNextVideo() {
+        var nextVideo = upcomingVideo()
+        if(nextVideo >= 0) YoutubeAPI.preresolveVideoUrl(playingModel.get(nextVideo).id)
+    }
+
+    //Opens the upcoming track on the standby player, it pauses at its start until the swap
+    function prerollNextVideo() {
+        if(crossfadeAnimation.running) return
+
+        var nextVideo = upcomingVideo()
+        if(nextVideo < 0) return
+
+        var id = playingModel.get(nextVideo).id
+        if(standbyVideoIndex === nextVideo && standbyVideoID === id) return
+        if(id === failedStandbyID) return
+
+        resetStandby()
+
+        var withVideo = videoStreamWanted(id)
+        var url = YoutubeAPI.prerollVideoUrl(id, withVideo)
+        if(!url.length) return
+
+        standbyVideoIndex = nextVideo
+        standbyVideoID = id
+        standbyWithVideo = withVideo
+        standbyPlayer.mrl = url
+        standbyPlayer.play()
+    }
+
+    function resetStandby() {
+        crossfadeAnimation.stop()
+        crossfadeProgress = 1
+
+        if(standbyPlayer.state !== VlcPlayer.Stopped) standbyPlayer.stop()
+        standbyVideoIndex = -1
+        standbyVideoID = ""
+        standbyReady = false
+    }
+
+    function swapPlayers(crossfade) {
+        crossfadeAnimation.stop()
+
+        var previousPlayer = mediaPlayer
+        mediaPlayer = standbyPlayer
+        standbyPlayer = previousPlayer
+
+        playRequestedTime = 0
+        videoStreamPlaying = standbyWithVideo
+        standbyVideoIndex = -1
+        standbyVideoID = ""
+        standbyReady = false
+
+        crossfadeProgress = 0
+        mediaPlayer.play()
+
+        if(crossfade && YoutubeAPI.crossfadeDuration > 0) {
+            crossfadeAnimation.duration = YoutubeAPI.crossfadeDuration
+            crossfadeAnimation.start()
+        }
+        else {
+            crossfadeProgress = 1
+            standbyPlayer.stop()
+        }
+    }
+
+    function playerVolume(player) {
+        var level = player === mediaPlayer ? crossfadeProgress : 1 - crossfadeProgress
+        return controlsBar.volume * 100 * level
+    }
+
+    function playerStateChanged(player) {
+        var state = player.state
+
+        if(player !== mediaPlayer) {
+            if(standbyVideoIndex < 0) return
+
+            if(state == VlcPlayer.Playing && !standbyReady) {
+                player.pause()
+                player.time = 0
+                standbyReady = true
+            }
+            else if(state == VlcPlayer.Error || state == VlcPlayer.Ended) {
+                //The track is resolved the usual way when its turn comes, it is not prerolled again until then
+                failedStandbyID = standbyVideoID
+                standbyVideoIndex = -1
+                standbyVideoID = ""
+                standbyReady = false
+            }
+
+            return
+        }
+
+        if(state == VlcPlayer.Playing && playRequestedTime) {
+            StreamBuffer.reportFirstAudio(new Date().getTime() - playRequestedTime)
+            playRequestedTime = 0
+        }
+
+        if(state == VlcPlayer.Playing && resumeTime) {
+            player.time = resumeTime
+            resumeTime = 0
+        }
+
+        if(state == VlcPlayer.Ended || state == VlcPlayer.Error) {
+
+            if(state == VlcPlayer.Error) {
+                if(currentVideoIndex == -1) return
+
+                var element = playingModel.get(currentVideoIndex)
+
+                var message
+                if(element.subtitle.length) message = "Problem playing item: " + element.title + " - " + element.subtitle
+                else message = "Problem playing item: " + element.title
+                ApplicationManager.triggerNotification(message)
+
+                if(playingModel.count == 0 || (shuffleEnabled && !shuffleList.length && !repeatEnabled) ||
+                        (currentVideoIndex >= playingModel.count - 1 && !repeatEnabled)) return
+
+                problemPlayingVideoTimer.start()
+            }
+            else {
+                if(playingModel.count == 0 || (shuffleEnabled && !shuffleList.length && !repeatEnabled) ||
+                        (currentVideoIndex >= playingModel.count - 1 && !repeatEnabled)) return
+
+                playNextVideo()
+            }
+        }
     }
 
     function playPreviousVideo() {
@@ -191,13 +386,8 @@ Rectangle {
         suggestionRequested = true
 
         var element = playingModel.get(Math.floor((Math.random() * (playingModel.count - 1))))
-        var queueList = new Array
 
-        for(var i = 0; i < playingModel.count; ++i) {
-            queueList.push(playingModel.get(i).id)
-        }
-
-        YoutubeAPI.suggestion(element.id, queueList)
+        YoutubeAPI.suggestion(element.id)
 
         console.log("New suggestion based on: " + element.title + "  " + element.subtitle)
     }
@@ -220,6 +410,7 @@ Rectangle {
         SideBar {
             id: sideBar
             width: 200
+            videoSurfaceEnabled: videoStreamPlaying
             height: parent.height
             clip: true
 
@@ -233,12 +424,14 @@ Rectangle {
                 videoFullscreen.currentVideoID = sideBar.currentVideoID
                 videoFullscreen.currentVideoFavorited = sideBar.currentVideoFavorited
                 ApplicationManager.showFullscreen()
+                requestVideoStream()
             }
 
             onMaximizeVideoRequested: {
                 videoMaximized.visible = true
                 videoMaximized.currentVideoID = sideBar.currentVideoID
                 videoMaximized.currentVideoFavorited = sideBar.currentVideoFavorited
+                requestVideoStream()
             }
 
             onMinimizeVideoRequested: {
@@ -374,6 +567,8 @@ Rectangle {
                 visible: false
                 aspectFill: false
                 mediaSource: mediaPlayer
+                surfaceEnabled: videoStreamPlaying
+                thumbnail: sideBar.currentThumbnail
                 fullscreen: false
 
                 anchors {
@@ -559,35 +754,48 @@ Rectangle {
     }
 
     VlcPlayer {
-        id: mediaPlayer
+        id: playerA
 
-        volume: controlsBar.volume * 100
+        volume: playerVolume(playerA)
 
-        onStateChanged: {
-            if(state == VlcPlayer.Ended || state == VlcPlayer.Error) {
+        onStateChanged: playerStateChanged(playerA)
+    }
 
-                if(state == VlcPlayer.Error) {
-                    if(currentVideoIndex == -1) return
+    VlcPlayer {
+        id: playerB
 
-                    var element = playingModel.get(currentVideoIndex)
+        volume: playerVolume(playerB)
 
-                    var message
-                    if(element.subtitle.length) message = "Problem playing item: " + element.title + " - " + element.subtitle
-                    else message = "Problem playing item: " + element.title
-                    ApplicationManager.triggerNotification(message)
+        onStateChanged: playerStateChanged(playerB)
+    }
 
-                    if(playingModel.count == 0 || (shuffleEnabled && !shuffleList.length && !repeatEnabled) ||
-                            (currentVideoIndex >= playingModel.count - 1 && !repeatEnabled)) return
+    NumberAnimation {
+        id: crossfadeAnimation
+        target: rootRect
+        property: "crossfadeProgress"
+        to: 1
 
-                    problemPlayingVideoTimer.start()
-                }
-                else {
-                    if(playingModel.count == 0 || (shuffleEnabled && !shuffleList.length && !repeatEnabled) ||
-                            (currentVideoIndex >= playingModel.count - 1 && !repeatEnabled)) return
+        onStopped: {
+            crossfadeProgress = 1
+            if(standbyVideoIndex < 0 && standbyPlayer.state !== VlcPlayer.Stopped) standbyPlayer.stop()
+        }
+    }
 
-                    playNextVideo()
-                }
-            }
+    //Prerolls the next track a while before the end and crossfades into it
+    Timer {
+        id: crossfadeTimer
+        interval: 250
+        repeat: true
+        running: mediaPlayer.state == VlcPlayer.Playing
+
+        onTriggered: {
+            if(mediaPlayer.length <= 0 || currentVideoIndex < 0) return
+
+            var remaining = mediaPlayer.length - mediaPlayer.time
+            if(remaining <= YoutubeAPI.crossfadeDuration + 15000) prerollNextVideo()
+
+            if(standbyReady && YoutubeAPI.crossfadeDuration > 0 && remaining <= YoutubeAPI.crossfadeDuration &&
+                    upcomingVideo() === standbyVideoIndex) playNextVideo(true)
         }
     }
 
@@ -634,12 +842,15 @@ Rectangle {
         }
 
         function pauseFunc() {
+            //The outgoing track does not keep fading while paused
+            if(crossfadeAnimation.running) crossfadeAnimation.complete()
             mediaPlayer.pause()
             var date = new Date();
             lastPausedTime = date.valueOf()
         }
 
         function stopFunc() {
+            resetStandby()
             mediaPlayer.stop()
         }
 
@@ -729,6 +940,8 @@ Rectangle {
         visible: false
         aspectFill: true
         mediaSource: mediaPlayer
+        surfaceEnabled: videoStreamPlaying
+        thumbnail: sideBar.currentThumbnail
         fullscreen: true
 
         anchors.fill: parent
@@ -955,6 +1168,14 @@ Rectangle {
         }
     }
 
+    Timer {
+        id: suggestionRetryTimer
+
+        onTriggered: {
+            if(mediaPlayer.state === VlcPlayer.Playing ||  mediaPlayer.state === VlcPlayer.Paused) newSuggestion()
+        }
+    }
+
     Connections {
         target: ApplicationManager
 
@@ -1100,12 +1321,40 @@ Rectangle {
         target: YoutubeAPI
 
         onVideoUrlSuccess: {
+            //A track skipped while resolving must not start playing
+            if(token !== videoUrlToken || id !== sideBar.currentVideoID) return
+
+            if(videoStreamRequested) {
+                videoStreamRequested = false
+                videoStreamPlaying = true
+            }
+
             console.log(url)
             mediaPlayer.mrl = url
             mediaPlayer.play()
+
+            preresolveNextVideo()
+        }
+
+        onVideoDurationSuccess: {
+            //Queue items restored without a duration get it once it is resolved
+            for(var i = 0; i < playingModel.count; ++i) {
+                var element = playingModel.get(i)
+                if(element.id === id && element.duration === "") playingModel.setProperty(i, "duration", duration)
+            }
+
+            if(sideBar.currentVideoID === id && sideBar.currentDuration === "") sideBar.currentDuration = duration
         }
 
         onVideoUrlFailed: {
+            if(token !== videoUrlToken) return
+
+            //The audio keeps playing when the video stream is not available
+            if(videoStreamRequested) {
+                videoStreamRequested = false
+                return
+            }
+
             console.log("Problem playing file: " + id)
 
             var element = playingModel.get(currentVideoIndex)
@@ -1158,8 +1407,12 @@ Rectangle {
         }
 
         onSuggestionFailed: {
-            if(mediaPlayer.state === VlcPlayer.Playing ||  mediaPlayer.state === VlcPlayer.Paused) newSuggestion()
-            else suggestionRequested = false
+            suggestionRequested = false
+
+            if(mediaPlayer.state === VlcPlayer.Playing ||  mediaPlayer.state === VlcPlayer.Paused) {
+                suggestionRetryTimer.interval = APIRateLimiter.retryDelay()
+                suggestionRetryTimer.restart()
+            }
         }
     }
 
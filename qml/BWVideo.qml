@@ -12,6 +12,8 @@ Rectangle {
     property bool thumbnailHovered: false
     property string currentVideoID
     property bool currentVideoFavorited
+    property bool surfaceEnabled: true
+    property string thumbnail
 
     signal close()
     signal fullscreenVideoRequested()
@@ -46,11 +48,21 @@ Rectangle {
         }
     }
 
+    //Without a video stream the surface is detached and only the thumbnail is shown
+    Image {
+        id: videoThumbnail
+        fillMode: aspectFill ? Image.PreserveAspectCrop : Image.PreserveAspectFit
+        asynchronous: true
+        visible: !surfaceEnabled
+        source: surfaceEnabled ? "" : thumbnail
+        anchors.fill: parent
+    }
+
     VlcVideoSurface {
         id: video
         anchors.fill: parent
         fillMode: aspectFill ? Qt.KeepAspectRatioByExpanding : Qt.KeepAspectRatio
-        source: mediaSource
+        source: surfaceEnabled ? mediaSource : null
 
         MouseArea {
             anchors.fill: parent
@@ -13,7 +13,7 @@ Rectangle {
     property var selectedTags: []
     property string nextPageToken
     property int pageNumber: 0
-    property bool searchRequested: false
+    property int searchRequestID: -1
     property bool menuOpened: false
 
     signal playVideoAndAddToQueue(string id, string title, string subtitle, string thumbnail, string duration)
@@ -22,11 +22,10 @@ Rectangle {
     signal dragVideosFinished()
 
     function checkLoadMore() {
-        if(searchRequested || nextPageToken.length == 0 || pageNumber > 5) return;
+        if(searchRequestID !== -1 || nextPageToken.length == 0 || pageNumber > 5) return;
 
         if(resultsGrid.contentY + resultsGrid.height > resultsGrid.contentHeight + 100) {
-            searchRequested = true
-            YoutubeAPI.search(searchString, nextPageToken)
+            searchRequestID = YoutubeAPI.search(searchModel, searchString, nextPageToken)
 
             ++pageNumber
         }
@@ -50,9 +49,9 @@ Rectangle {
 
         informativeText.text = "FETCHING..."
         searchModel.clear()
-        searchRequested = true
         pageNumber = 0
-        YoutubeAPI.search(searchString)
+        nextPageToken = ""
+        searchRequestID = YoutubeAPI.search(searchModel, searchString)
     }
 
     TOPListModel {
@@ -93,7 +92,7 @@ Rectangle {
         }
     }
 
-    ListModel {
+    SearchResultsModel {
         id: searchModel
     }
 
@@ -528,65 +527,18 @@ Rectangle {
         target: YoutubeAPI
 
         onSearchSuccess: {
-            if(!searchRequested) return;
+            if(requestID !== searchRequestID) return;
 
-            searchRequested = false
-            var obj = JSON.parse(documentString);
-
-            if(obj.hasOwnProperty("nextPageToken")) {
-                nextPageToken = obj["nextPageToken"]
-            }
-            else {
-                nextPageToken = ""
-            }
-
-            for(var key in obj["items"]) {
-                if(key === "nextPageToken") continue
-
-                var videoID = obj["items"][key]["id"]
-                var title = obj["items"][key]["title"]
-                var videoThumbnailUrl = obj["items"][key]["thumbnail"]
-                var videoDuration = obj["items"][key]["duration"]
-
-                var videoTitle;
-                var videoSubTitle;
-
-                if(title) {
-                    var count = 3
-                    var separatorIndex = title.indexOf(" - ")
-                    if(separatorIndex === -1) {
-                        count = 2
-                        separatorIndex = title.indexOf(", ")
-
-                        if(separatorIndex === -1) {
-                            count = 1
-                            separatorIndex = title.indexOf(" \"")
-
-                            if(separatorIndex === 0) separatorIndex = -1
-                        }
-                    }
-
-                    if(separatorIndex === -1) {
-                        videoTitle = title
-                        videoSubTitle = ""
-                    }
-                    else {
-                        var artist = title.substring(0, separatorIndex)
-                        var trackName = title.substring(separatorIndex + count, title.length)
-
-                        videoTitle = artist
-                        videoSubTitle = trackName
-                    }
-                }
-
-                searchModel.append({"id": videoID, "title": videoTitle, "subtitle": videoSubTitle, "thumbnail": videoThumbnailUrl, "duration": videoDuration})
-            }
+            searchRequestID = -1
+            nextPageToken = searchModel.nextPageToken
 
             if(searchModel.count == 0) informativeText.text = "NO RESULTS FOUND"
         }
 
         onSearchFailed: {
-            searchRequested = false
+            if(requestID !== searchRequestID) return;
+
+            searchRequestID = -1
         }
     }
 
@@ -289,6 +289,32 @@ Rectangle {
             }
         }
 
+        BWSwitch {
+            id: offlineSwitch
+            height: 16
+            on: MediaCache.enabled
+            labelText: "keep offline"
+            labelColor: "#929292"
+            labelFont: "Open Sans"
+            labelPixelSize: 11
+            labelRightSide: false
+
+            fillColor: "#00addc"
+            borderColor: "white"
+            knobBorderWidth: 1
+            backgroundColor: "#666666"
+
+            anchors {
+                right: searchForm.left
+                rightMargin: 20
+                verticalCenter: parent.verticalCenter
+            }
+
+            onOnChanged: {
+                if(on !== MediaCache.enabled) MediaCache.setEnabled(on)
+            }
+        }
+
         Rectangle {
             id: searchForm
             color: "#ebeff1"
@@ -352,6 +352,39 @@ Rectangle {
             }
         }
 
+        Item {
+            id: audioOnlyItem
+            width: childrenRect.width
+            height: 30
+
+            anchors {
+                top: passwordItem.bottom
+                topMargin: 10
+            }
+
+            BWSwitch {
+                id: audioOnlySwitch
+                height: 16
+                on: YoutubeAPI.audioOnly
+                labelText: "audio only (video streams when the video is opened)"
+                labelColor: "#a5a9aa"
+                labelFont: "Open Sans"
+                labelPixelSize: 13
+                labelRightSide: true
+
+                fillColor: "#00addc"
+                borderColor: "white"
+                knobBorderWidth: 1
+                backgroundColor: "#666666"
+
+                anchors.verticalCenter: parent.verticalCenter
+
+                onOnChanged: {
+                    if(on !== YoutubeAPI.audioOnly) YoutubeAPI.setAudioOnly(on)
+                }
+            }
+        }
+
         BWButton {
             id: buttonDeleteAccount
             width: buttonDeleteAccountText.width + 20
@@ -362,7 +395,7 @@ Rectangle {
             radius: 5
 
             anchors {
-                top: passwordItem.bottom
+                top: audioOnlyItem.bottom
                 topMargin: 50
             }
 
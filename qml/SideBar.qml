@@ -17,6 +17,7 @@ Rectangle {
     property bool videoMaximized: false
     property bool userSettings: false
     property bool thumbnailHovered: false
+    property bool videoSurfaceEnabled: true
 
     signal playlistCreated(string id)
     signal fullscreenVideoRequested
@@ -428,7 +429,7 @@ Rectangle {
         fillMode: Image.PreserveAspectCrop
         asynchronous: true
         anchors.fill: video
-        visible: !video.visible || (mediaPlayer.state != VlcPlayer.Playing && mediaPlayer.state != VlcPlayer.Paused)
+        visible: !video.visible || !videoSurfaceEnabled || (mediaPlayer.state != VlcPlayer.Playing && mediaPlayer.state != VlcPlayer.Paused)
         source: currentThumbnail
     }
 
@@ -437,7 +438,7 @@ Rectangle {
         width: parent.width
         height: 200
         fillMode: Qt.KeepAspectRatioByExpanding
-        source: currentVideo
+        source: videoSurfaceEnabled ? currentVideo : null
 
         anchors {
             bottom: videoTitleHolder.top
@@ -0,0 +1,305 @@
+#include "searchcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonObject>
+#include <QCoreApplication>
+#include <QTimer>
+#include <QDebug>
+
+#define INDEX_SAVE_DELAY 5000
+
+struct SearchCacheEntry
+{
+    SearchCacheEntry() : created(0), accessed(0), size(0) {}
+
+    qint64 created;
+    qint64 accessed;
+    qint64 size;
+};
+
+class SearchCachePrivate
+{
+public:
+    SearchCachePrivate() :
+        timeToLive(6 * 60 * 60),
+        maximumSize(20 * 1024 * 1024),
+        size(0),
+        hits(0),
+        misses(0),
+        indexDirty(false),
+        saveTimer(0)
+    {}
+
+    virtual ~SearchCachePrivate()
+    {
+    }
+
+    QString filePath(const QString& key) const
+    {
+        return path + "/" + QString(QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex()) + ".json";
+    }
+
+    QString indexPath() const
+    {
+        return path + "/index.json";
+    }
+
+    void loadIndex()
+    {
+        QFile indexFile(indexPath());
+        if(!indexFile.open(QFile::ReadOnly)) return;
+
+        QJsonObject indexObj = QJsonDocument::fromJson(indexFile.readAll()).object();
+        foreach(QString key, indexObj.keys())
+        {
+            QJsonObject entryObj = indexObj.value(key).toObject();
+            if(!QFile::exists(filePath(key))) continue;
+
+            SearchCacheEntry entry;
+            entry.created = entryObj.value("created").toVariant().toLongLong();
+            entry.accessed = entryObj.value("accessed").toVariant().toLongLong();
+            entry.size = entryObj.value("size").toVariant().toLongLong();
+            entries.insert(key, entry);
+            size += entry.size;
+        }
+    }
+
+    void saveIndex()
+    {
+        if(!indexDirty) return;
+
+        QJsonObject indexObj;
+        foreach(QString key, entries.keys())
+        {
+            const SearchCacheEntry& entry = entries[key];
+
+            QJsonObject entryObj;
+            entryObj.insert("created", QString::number(entry.created));
+            entryObj.insert("accessed", QString::number(entry.accessed));
+            entryObj.insert("size", QString::number(entry.size));
+            indexObj.insert(key, entryObj);
+        }
+
+        QSaveFile indexFile(indexPath());
+        if(!indexFile.open(QFile::WriteOnly)) return;
+        indexFile.write(QJsonDocument(indexObj).toJson(QJsonDocument::Compact));
+        if(indexFile.commit()) indexDirty = false;
+    }
+
+    void remove(const QString& key)
+    {
+        if(!entries.contains(key)) return;
+
+        size -= entries.value(key).size;
+        entries.remove(key);
+        QFile::remove(filePath(key));
+        indexDirty = true;
+    }
+
+    void evict()
+    {
+        while(size > maximumSize && !entries.isEmpty())
+        {
+            QString leastRecentKey;
+            qint64 leastRecentAccess = 0;
+
+            QHash<QString, SearchCacheEntry>::const_iterator it = entries.constBegin();
+            for(; it != entries.constEnd(); ++it)
+            {
+                if(leastRecentKey.isEmpty() || it.value().accessed < leastRecentAccess)
+                {
+                    leastRecentKey = it.key();
+                    leastRecentAccess = it.value().accessed;
+                }
+            }
+
+            remove(leastRecentKey);
+        }
+    }
+
+    QString path;
+
+    int timeToLive;
+    qint64 maximumSize;
+    qint64 size;
+
+    int hits;
+    int misses;
+
+    bool indexDirty;
+    QTimer *saveTimer;
+    QHash<QString, SearchCacheEntry> entries;
+};
+
+SearchCache::SearchCache(const QString &path, QObject *parent) :
+    QObject(parent),
+    d_ptr(new SearchCachePrivate)
+{
+    Q_D(SearchCache);
+
+    d->path = path;
+    QDir().mkpath(d->path);
+    d->loadIndex();
+
+    //Access times change on every hit, they are written out together
+    d->saveTimer = new QTimer(this);
+    d->saveTimer->setSingleShot(true);
+    d->saveTimer->setInterval(INDEX_SAVE_DELAY);
+    connect(d->saveTimer, SIGNAL(timeout()), SLOT(saveIndex()));
+
+    if(QCoreApplication::instance()) connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), SLOT(saveIndex()));
+}
+
+SearchCache::~SearchCache()
+{
+    Q_D(SearchCache);
+    d->saveIndex();
+    delete d_ptr;
+}
+
+QString SearchCache::key(const QString &search, const QString &orderBy, const QString &duration, const bool &onlyMusic, const QString &pageToken)
+{
+    return search.trimmed().toLower() + "|" + orderBy + "|" + duration + "|" + (onlyMusic ? "music" : "all") + "|" + pageToken;
+}
+
+int SearchCache::timeToLive() const
+{
+    Q_D(const SearchCache);
+    return d->timeToLive;
+}
+
+void SearchCache::setTimeToLive(const int &seconds)
+{
+    Q_D(SearchCache);
+    d->timeToLive = seconds;
+}
+
+qint64 SearchCache::maximumSize() const
+{
+    Q_D(const SearchCache);
+    return d->maximumSize;
+}
+
+void SearchCache::setMaximumSize(const qint64 &bytes)
+{
+    Q_D(SearchCache);
+    d->maximumSize = bytes;
+    d->evict();
+    d->saveIndex();
+}
+
+bool SearchCache::contains(const QString &key) const
+{
+    Q_D(const SearchCache);
+
+    if(!d->entries.contains(key)) return false;
+    return QDateTime::currentMSecsSinceEpoch() - d->entries.value(key).created <= qint64(d->timeToLive) * 1000;
+}
+
+QJsonDocument SearchCache::page(const QString &key)
+{
+    Q_D(SearchCache);
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    if(d->entries.contains(key) && now - d->entries.value(key).created > qint64(d->timeToLive) * 1000)
+    {
+        d->remove(key);
+    }
+
+    QJsonDocument document;
+
+    if(d->entries.contains(key))
+    {
+        QFile pageFile(d->filePath(key));
+        if(pageFile.open(QFile::ReadOnly)) document = QJsonDocument::fromJson(pageFile.readAll());
+
+        if(document.isNull()) d->remove(key);
+        else
+        {
+            d->entries[key].accessed = now;
+            d->indexDirty = true;
+            if(!d->saveTimer->isActive()) d->saveTimer->start();
+        }
+    }
+
+    if(document.isNull()) ++d->misses;
+    else ++d->hits;
+
+    emit statisticsChanged();
+    return document;
+}
+
+void SearchCache::insert(const QString &key, const QJsonDocument &page)
+{
+    Q_D(SearchCache);
+
+    const QByteArray pageBA = page.toJson(QJsonDocument::Compact);
+
+    QSaveFile pageFile(d->filePath(key));
+    if(!pageFile.open(QFile::WriteOnly))
+    {
+        qDebug() << "Search cache could not write" << pageFile.fileName();
+        return;
+    }
+    pageFile.write(pageBA);
+    if(!pageFile.commit()) return;
+
+    if(d->entries.contains(key)) d->size -= d->entries.value(key).size;
+
+    SearchCacheEntry entry;
+    entry.created = QDateTime::currentMSecsSinceEpoch();
+    entry.accessed = entry.created;
+    entry.size = pageBA.size();
+    d->entries.insert(key, entry);
+    d->size += entry.size;
+    d->indexDirty = true;
+
+    d->evict();
+    if(!d->saveTimer->isActive()) d->saveTimer->start();
+
+    emit statisticsChanged();
+}
+
+void SearchCache::clear()
+{
+    Q_D(SearchCache);
+
+    foreach(QString key, d->entries.keys())
+    {
+        d->remove(key);
+    }
+    d->saveIndex();
+
+    emit statisticsChanged();
+}
+
+int SearchCache::hits() const
+{
+    Q_D(const SearchCache);
+    return d->hits;
+}
+
+int SearchCache::misses() const
+{
+    Q_D(const SearchCache);
+    return d->misses;
+}
+
+void SearchCache::saveIndex()
+{
+    Q_D(SearchCache);
+
+    d->saveTimer->stop();
+    d->saveIndex();
+}
+
+qint64 SearchCache::size() const
+{
+    Q_D(const SearchCache);
+    return d->size;
+}
@@ -0,0 +1,49 @@
+#ifndef SEARCHCACHE_H
+#define SEARCHCACHE_H
+
+#include <QObject>
+#include <QJsonDocument>
+
+class SearchCachePrivate;
+class SearchCache : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int hits READ hits NOTIFY statisticsChanged)
+    Q_PROPERTY(int misses READ misses NOTIFY statisticsChanged)
+    Q_PROPERTY(qint64 size READ size NOTIFY statisticsChanged)
+
+public:
+    explicit SearchCache(const QString& path, QObject *parent = 0);
+    virtual ~SearchCache();
+
+    static QString key(const QString& search, const QString& orderBy, const QString& duration, const bool& onlyMusic, const QString& pageToken);
+
+    int timeToLive() const;
+    void setTimeToLive(const int& seconds);
+
+    qint64 maximumSize() const;
+    void setMaximumSize(const qint64& bytes);
+
+    bool contains(const QString& key) const;
+    QJsonDocument page(const QString& key);
+    void insert(const QString& key, const QJsonDocument& page);
+    void clear();
+
+    int hits() const;
+    int misses() const;
+    qint64 size() const;
+
+signals:
+    void statisticsChanged();
+
+public slots:
+    void saveIndex();
+
+private:
+    Q_DECLARE_PRIVATE(SearchCache)
+    SearchCachePrivate * const d_ptr;
+
+};
+
+#endif // SEARCHCACHE_H
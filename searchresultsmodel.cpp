@@ -0,0 +1,195 @@
+#include "searchresultsmodel.h"
+
+#include <QtQml>
+
+class SearchResultsModelPrivate
+{
+public:
+    SearchResultsModelPrivate()
+    {}
+
+    virtual ~SearchResultsModelPrivate()
+    {
+    }
+
+    QList<SearchResult> results;
+    QHash<QString, QList<int> > rowsByID;
+    QString nextPageToken;
+};
+
+SearchResultsModel::SearchResultsModel(QObject *parent) :
+    QAbstractListModel(parent),
+    d_ptr(new SearchResultsModelPrivate)
+{
+}
+
+SearchResultsModel::~SearchResultsModel()
+{
+    delete d_ptr;
+}
+
+void SearchResultsModel::declareQML()
+{
+    qmlRegisterType<SearchResultsModel>("BeatWhaleAPI", 1, 0, "SearchResultsModel");
+}
+
+void SearchResultsModel::splitTitle(const QString &fullTitle, QString *title, QString *subTitle)
+{
+    int count = 3;
+    int separatorIndex = fullTitle.indexOf(" - ");
+    if(separatorIndex == -1)
+    {
+        count = 2;
+        separatorIndex = fullTitle.indexOf(", ");
+
+        if(separatorIndex == -1)
+        {
+            count = 1;
+            separatorIndex = fullTitle.indexOf(" \"");
+
+            if(separatorIndex == 0) separatorIndex = -1;
+        }
+    }
+
+    if(separatorIndex == -1)
+    {
+        *title = fullTitle;
+        *subTitle = "";
+    }
+    else
+    {
+        *title = fullTitle.left(separatorIndex);
+        *subTitle = fullTitle.mid(separatorIndex + count);
+    }
+}
+
+int SearchResultsModel::rowCount(const QModelIndex &parent) const
+{
+    Q_D(const SearchResultsModel);
+
+    if(parent.isValid()) return 0;
+    return d->results.count();
+}
+
+QVariant SearchResultsModel::data(const QModelIndex &index, int role) const
+{
+    Q_D(const SearchResultsModel);
+
+    if(!index.isValid() || index.row() < 0 || index.row() >= d->results.count()) return QVariant();
+
+    const SearchResult& result = d->results.at(index.row());
+
+    switch(role)
+    {
+    case IDRole:
+        return result.id;
+    case TitleRole:
+        return result.title;
+    case SubTitleRole:
+        return result.subTitle;
+    case ThumbnailRole:
+        return result.thumbnail;
+    case DurationRole:
+        return result.duration;
+    default:
+        break;
+    }
+
+    return QVariant();
+}
+
+QHash<int, QByteArray> SearchResultsModel::roleNames() const
+{
+    QHash<int, QByteArray> roles;
+    roles.insert(IDRole, "id");
+    roles.insert(TitleRole, "title");
+    roles.insert(SubTitleRole, "subtitle");
+    roles.insert(ThumbnailRole, "thumbnail");
+    roles.insert(DurationRole, "duration");
+    return roles;
+}
+
+int SearchResultsModel::count() const
+{
+    Q_D(const SearchResultsModel);
+    return d->results.count();
+}
+
+QString SearchResultsModel::nextPageToken() const
+{
+    Q_D(const SearchResultsModel);
+    return d->nextPageToken;
+}
+
+void SearchResultsModel::setNextPageToken(const QString &nextPageToken)
+{
+    Q_D(SearchResultsModel);
+    if(d->nextPageToken == nextPageToken) return;
+
+    d->nextPageToken = nextPageToken;
+    emit nextPageTokenChanged(d->nextPageToken);
+}
+
+void SearchResultsModel::appendResults(const QList<SearchResult> &results)
+{
+    Q_D(SearchResultsModel);
+
+    if(results.isEmpty()) return;
+
+    int firstRow = d->results.count();
+
+    beginInsertRows(QModelIndex(), firstRow, firstRow + results.count() - 1);
+    for(int i = 0; i < results.count(); ++i)
+    {
+        d->results.append(results.at(i));
+        d->rowsByID[results.at(i).id].append(firstRow + i);
+    }
+    endInsertRows();
+
+    emit countChanged(d->results.count());
+}
+
+void SearchResultsModel::setDuration(const QString &id, const QString &duration)
+{
+    Q_D(SearchResultsModel);
+
+    QVector<int> roles;
+    roles.append(DurationRole);
+
+    foreach(int row, d->rowsByID.value(id))
+    {
+        if(d->results.at(row).duration == duration) continue;
+
+        d->results[row].duration = duration;
+        emit dataChanged(index(row), index(row), roles);
+    }
+}
+
+QVariantMap SearchResultsModel::get(const int &index) const
+{
+    Q_D(const SearchResultsModel);
+
+    QVariantMap resultMap;
+    if(index < 0 || index >= d->results.count()) return resultMap;
+
+    const SearchResult& result = d->results.at(index);
+    resultMap.insert("id", result.id);
+    resultMap.insert("title", result.title);
+    resultMap.insert("subtitle", result.subTitle);
+    resultMap.insert("thumbnail", result.thumbnail);
+    resultMap.insert("duration", result.duration);
+    return resultMap;
+}
+
+void SearchResultsModel::clear()
+{
+    Q_D(SearchResultsModel);
+
+    beginResetModel();
+    d->results.clear();
+    d->rowsByID.clear();
+    endResetModel();
+
+    setNextPageToken("");
+    emit countChanged(d->results.count());
+}
@@ -0,0 +1,65 @@
+#ifndef SEARCHRESULTSMODEL_H
+#define SEARCHRESULTSMODEL_H
+
+#include <QAbstractListModel>
+#include <QStringList>
+
+struct SearchResult
+{
+    QString id;
+    QString title;
+    QString subTitle;
+    QString thumbnail;
+    QString duration;
+};
+
+class SearchResultsModelPrivate;
+class SearchResultsModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+    Q_PROPERTY(QString nextPageToken READ nextPageToken NOTIFY nextPageTokenChanged)
+
+public:
+    enum Roles
+    {
+        IDRole = Qt::UserRole + 1,
+        TitleRole,
+        SubTitleRole,
+        ThumbnailRole,
+        DurationRole
+    };
+
+    explicit SearchResultsModel(QObject *parent = 0);
+    virtual ~SearchResultsModel();
+
+    static void declareQML();
+    static void splitTitle(const QString& fullTitle, QString *title, QString *subTitle);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    QHash<int, QByteArray> roleNames() const;
+
+    int count() const;
+
+    QString nextPageToken() const;
+    void setNextPageToken(const QString& nextPageToken);
+
+    void appendResults(const QList<SearchResult>& results);
+    void setDuration(const QString& id, const QString& duration);
+
+    Q_INVOKABLE QVariantMap get(const int& index) const;
+    Q_INVOKABLE void clear();
+
+signals:
+    void countChanged(const int& count);
+    void nextPageTokenChanged(const QString& nextPageToken);
+
+private:
+    Q_DECLARE_PRIVATE(SearchResultsModel)
+    SearchResultsModelPrivate * const d_ptr;
+
+};
+
+#endif // SEARCHRESULTSMODEL_H
@@ -0,0 +1,699 @@
+#include "streambuffer.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QRegularExpression>
+#include <QDateTime>
+#include <QSettings>
+#include <QDebug>
+
+#define SOCKET_WRITE_LIMIT 262144
+#define WRITE_CHUNK_SIZE 65536
+
+StreamBuffer *StreamBuffer::_singleton = 0;
+
+struct StreamPrefix
+{
+    StreamPrefix() : total(0), reply(0), finished(false), failed(false), created(0) {}
+
+    QString url;
+    QByteArray data;
+    qint64 total;
+    QString contentType;
+    QNetworkReply *reply;
+    bool finished;
+    bool failed;
+    qint64 created;
+};
+
+struct StreamSession
+{
+    StreamSession() : position(0), headersSent(false), upstream(0), upstreamChecked(false) {}
+
+    QByteArray request;
+    QString videoID;
+    QString url;
+    qint64 position;
+    bool headersSent;
+    QNetworkReply *upstream;
+    bool upstreamChecked;
+};
+
+//Content-Range carries the full size after the slash, a plain 200 only has Content-Length
+static qint64 replyTotalSize(QNetworkReply *reply, const qint64& offset)
+{
+    QRegularExpressionMatch match = QRegularExpression("/(\\d+)$").match(QString(reply->rawHeader("Content-Range")));
+    if(match.hasMatch()) return match.captured(1).toLongLong();
+
+    qint64 length = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    return length > 0 ? offset + length : 0;
+}
+
+class StreamBufferPrivate
+{
+public:
+    StreamBufferPrivate() :
+        networkManager(0),
+        server(0),
+        budget(8 * 1024 * 1024),
+        trackBudget(2 * 1024 * 1024),
+        hits(0),
+        misses(0),
+        lastPlaybackHit(false),
+        prerollHit(false),
+        bufferedTimeToFirstAudio(0),
+        liveTimeToFirstAudio(0)
+    {
+        QSettings settings("beatwhale_config.ini", QSettings::IniFormat);
+        budget = settings.value("read_ahead_budget", budget).toLongLong();
+        trackBudget = settings.value("read_ahead_track", trackBudget).toLongLong();
+    }
+
+    virtual ~StreamBufferPrivate()
+    {
+        qDeleteAll(sessions);
+    }
+
+    qint64 reservedBytes() const
+    {
+        qint64 reserved = 0;
+        foreach(StreamPrefix prefix, prefixes)
+        {
+            reserved += prefix.finished || prefix.failed ? prefix.data.size() : trackBudget;
+        }
+        return reserved;
+    }
+
+    QNetworkAccessManager *networkManager;
+    QTcpServer *server;
+
+    qint64 budget;
+    qint64 trackBudget;
+
+    QHash<QString, StreamPrefix> prefixes;
+    QHash<QNetworkReply*, QString> prefixReplies;
+    QHash<QTcpSocket*, StreamSession*> sessions;
+    QHash<QNetworkReply*, QTcpSocket*> upstreamReplies;
+
+    //The track playing right now stays reachable after its prefix is evicted, VLC reconnects to seek
+    QString playingID;
+    QString playingUrl;
+
+    //The standby player streams the next track alongside, it only takes over the playing slot at the swap
+    QString prerollID;
+    QString prerollUrl;
+    bool prerollHit;
+
+    int hits;
+    int misses;
+    bool lastPlaybackHit;
+    double bufferedTimeToFirstAudio;
+    double liveTimeToFirstAudio;
+};
+
+StreamBuffer::StreamBuffer(QObject *parent) :
+    QObject(parent),
+    d_ptr(new StreamBufferPrivate)
+{
+    Q_D(StreamBuffer);
+
+    d->networkManager = new QNetworkAccessManager(this);
+
+    d->server = new QTcpServer(this);
+    connect(d->server, SIGNAL(newConnection()), SLOT(newConnection()));
+    if(!d->server->listen(QHostAddress::LocalHost))
+    {
+        qDebug() << "Stream buffer could not listen" << d->server->errorString();
+    }
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    delete d_ptr;
+}
+
+StreamBuffer *StreamBuffer::singleton()
+{
+    if(!_singleton)
+    {
+        _singleton = new StreamBuffer;
+    }
+    return _singleton;
+}
+
+void StreamBuffer::declareQML()
+{
+    qmlRegisterSingletonType<StreamBuffer>("BeatWhaleAPI", 1, 0, "StreamBuffer", qmlStreamBufferSingleton);
+}
+
+void StreamBuffer::prefetch(const QString &videoID, const QString &url)
+{
+    Q_D(StreamBuffer);
+
+    if(videoID.isEmpty() || url.isEmpty() || !d->server->isListening() || d->trackBudget <= 0) return;
+
+    if(d->prefixes.contains(videoID))
+    {
+        if(d->prefixes.value(videoID).url == url && !d->prefixes.value(videoID).failed) return;
+
+        QNetworkReply *reply = d->prefixes.value(videoID).reply;
+        if(reply)
+        {
+            d->prefixReplies.remove(reply);
+            disconnect(reply, 0, this, 0);
+            reply->abort();
+            reply->deleteLater();
+        }
+        d->prefixes.remove(videoID);
+    }
+
+    evict(d->trackBudget);
+    if(d->reservedBytes() + d->trackBudget > d->budget) return;
+
+    //Only the first bytes are fetched, enough for VLC to fill its network cache without waiting
+    QNetworkRequest request(url);
+    request.setRawHeader("Range", "bytes=0-" + QByteArray::number(d->trackBudget - 1));
+
+    StreamPrefix prefix;
+    prefix.url = url;
+    prefix.created = QDateTime::currentMSecsSinceEpoch();
+    prefix.reply = d->networkManager->get(request);
+    d->prefixes.insert(videoID, prefix);
+    d->prefixReplies.insert(prefix.reply, videoID);
+
+    connect(prefix.reply, SIGNAL(metaDataChanged()), SLOT(prefetchMetaDataChanged()));
+    connect(prefix.reply, SIGNAL(readyRead()), SLOT(prefetchReadyRead()));
+    connect(prefix.reply, SIGNAL(finished()), SLOT(prefetchFinished()));
+
+    emit statisticsChanged();
+}
+
+QString StreamBuffer::playbackUrl(const QString &videoID, const QString &url)
+{
+    Q_D(StreamBuffer);
+
+    d->lastPlaybackHit = contains(videoID) && d->prefixes.value(videoID).url == url;
+
+    if(d->lastPlaybackHit) ++d->hits;
+    else ++d->misses;
+
+    emit statisticsChanged();
+
+    if(!d->lastPlaybackHit) return url;
+
+    d->playingID = videoID;
+    d->playingUrl = url;
+
+    return QString("http://127.0.0.1:%1/%2").arg(d->server->serverPort()).arg(videoID);
+}
+
+QString StreamBuffer::prerollUrl(const QString &videoID, const QString &url)
+{
+    Q_D(StreamBuffer);
+
+    d->prerollID = videoID;
+    d->prerollUrl = url;
+    d->prerollHit = contains(videoID) && d->prefixes.value(videoID).url == url;
+
+    if(!d->prerollHit) return url;
+
+    return QString("http://127.0.0.1:%1/%2").arg(d->server->serverPort()).arg(videoID);
+}
+
+void StreamBuffer::prerollPlayed(const QString &videoID)
+{
+    Q_D(StreamBuffer);
+
+    if(videoID.isEmpty() || videoID != d->prerollID) return;
+
+    d->lastPlaybackHit = d->prerollHit;
+
+    if(d->lastPlaybackHit) ++d->hits;
+    else ++d->misses;
+
+    if(d->lastPlaybackHit)
+    {
+        d->playingID = d->prerollID;
+        d->playingUrl = d->prerollUrl;
+    }
+
+    d->prerollID.clear();
+    d->prerollUrl.clear();
+    d->prerollHit = false;
+
+    emit statisticsChanged();
+}
+
+bool StreamBuffer::contains(const QString &videoID) const
+{
+    Q_D(const StreamBuffer);
+    return d->prefixes.contains(videoID) && !d->prefixes.value(videoID).failed;
+}
+
+qint64 StreamBuffer::budget() const
+{
+    Q_D(const StreamBuffer);
+    return d->budget;
+}
+
+void StreamBuffer::setBudget(const qint64 &budget)
+{
+    Q_D(StreamBuffer);
+
+    d->budget = qMax(qint64(0), budget);
+    evict(0);
+
+    emit statisticsChanged();
+}
+
+qint64 StreamBuffer::trackBudget() const
+{
+    Q_D(const StreamBuffer);
+    return d->trackBudget;
+}
+
+void StreamBuffer::setTrackBudget(const qint64 &budget)
+{
+    Q_D(StreamBuffer);
+
+    d->trackBudget = qMax(qint64(0), budget);
+
+    emit statisticsChanged();
+}
+
+qint64 StreamBuffer::bufferedBytes() const
+{
+    Q_D(const StreamBuffer);
+
+    qint64 buffered = 0;
+    foreach(StreamPrefix prefix, d->prefixes)
+    {
+        buffered += prefix.data.size();
+    }
+    return buffered;
+}
+
+int StreamBuffer::hits() const
+{
+    Q_D(const StreamBuffer);
+    return d->hits;
+}
+
+int StreamBuffer::misses() const
+{
+    Q_D(const StreamBuffer);
+    return d->misses;
+}
+
+double StreamBuffer::hitRate() const
+{
+    Q_D(const StreamBuffer);
+
+    if(!d->hits && !d->misses) return 0;
+    return double(d->hits) / (d->hits + d->misses);
+}
+
+int StreamBuffer::bufferedTimeToFirstAudio() const
+{
+    Q_D(const StreamBuffer);
+    return int(d->bufferedTimeToFirstAudio);
+}
+
+int StreamBuffer::liveTimeToFirstAudio() const
+{
+    Q_D(const StreamBuffer);
+    return int(d->liveTimeToFirstAudio);
+}
+
+void StreamBuffer::reportFirstAudio(const int &msecs)
+{
+    Q_D(StreamBuffer);
+
+    if(msecs < 0) return;
+
+    double& average = d->lastPlaybackHit ? d->bufferedTimeToFirstAudio : d->liveTimeToFirstAudio;
+    average = average ? average * 0.8 + msecs * 0.2 : msecs;
+
+    qDebug() << "Time to first audio" << msecs << "ms" << (d->lastPlaybackHit ? "from the read-ahead buffer" : "from the live stream");
+
+    emit statisticsChanged();
+}
+
+void StreamBuffer::newConnection()
+{
+    Q_D(StreamBuffer);
+
+    while(d->server->hasPendingConnections())
+    {
+        QTcpSocket *socket = d->server->nextPendingConnection();
+        d->sessions.insert(socket, new StreamSession);
+
+        connect(socket, SIGNAL(readyRead()), SLOT(sessionReadyRead()));
+        connect(socket, SIGNAL(bytesWritten(qint64)), SLOT(sessionBytesWritten()));
+        connect(socket, SIGNAL(disconnected()), SLOT(sessionDisconnected()));
+    }
+}
+
+void StreamBuffer::prefetchMetaDataChanged()
+{
+    Q_D(StreamBuffer);
+
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if(!reply || !d->prefixReplies.contains(reply)) return;
+
+    QString videoID = d->prefixReplies.value(reply);
+    StreamPrefix& prefix = d->prefixes[videoID];
+
+    prefix.total = replyTotalSize(reply, 0);
+    prefix.contentType = reply->header(QNetworkRequest::ContentTypeHeader).toString();
+
+    pumpWaitingSessions(videoID);
+}
+
+void StreamBuffer::prefetchReadyRead()
+{
+    Q_D(StreamBuffer);
+
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if(!reply || !d->prefixReplies.contains(reply)) return;
+
+    QString videoID = d->prefixReplies.value(reply);
+    StreamPrefix& prefix = d->prefixes[videoID];
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if(status != 200 && status != 206) return;
+
+    prefix.data.append(reply->readAll());
+
+    //A server ignoring the range sends the whole stream, the rest is left to the live request
+    if(prefix.data.size() >= d->trackBudget)
+    {
+        prefix.data.truncate(d->trackBudget);
+        prefix.finished = true;
+        prefix.reply = 0;
+
+        d->prefixReplies.remove(reply);
+        disconnect(reply, 0, this, 0);
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    pumpWaitingSessions(videoID);
+}
+
+void StreamBuffer::prefetchFinished()
+{
+    Q_D(StreamBuffer);
+
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if(!reply || !d->prefixReplies.contains(reply)) return;
+
+    QString videoID = d->prefixReplies.take(reply);
+    StreamPrefix& prefix = d->prefixes[videoID];
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if(reply->error() == QNetworkReply::NoError && (status == 200 || status == 206))
+    {
+        prefix.data.append(reply->readAll());
+        prefix.finished = true;
+    }
+    else
+    {
+        qDebug() << "Stream buffer could not read ahead" << videoID << reply->errorString();
+        prefix.failed = true;
+    }
+    prefix.reply = 0;
+
+    reply->deleteLater();
+
+    pumpWaitingSessions(videoID);
+
+    emit statisticsChanged();
+}
+
+void StreamBuffer::sessionReadyRead()
+{
+    Q_D(StreamBuffer);
+
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    StreamSession *session = d->sessions.value(socket, 0);
+    if(!session || !session->videoID.isEmpty()) return;
+
+    session->request.append(socket->readAll());
+    if(!session->request.contains("\r\n\r\n")) return;
+
+    QString request = session->request;
+    QStringList requestLine = request.left(request.indexOf("\r\n")).split(" ");
+    QString videoID = requestLine.value(1).mid(1);
+
+    if(d->prefixes.contains(videoID)) session->url = d->prefixes.value(videoID).url;
+    else if(videoID == d->playingID) session->url = d->playingUrl;
+    else if(videoID == d->prerollID) session->url = d->prerollUrl;
+
+    if(requestLine.value(0) != "GET" || session->url.isEmpty())
+    {
+        socket->write("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        socket->disconnectFromHost();
+        return;
+    }
+
+    session->videoID = videoID;
+
+    QRegularExpressionMatch range = QRegularExpression("^Range:\\s*bytes=(\\d+)-", QRegularExpression::CaseInsensitiveOption | QRegularExpression::MultilineOption).match(request);
+    if(range.hasMatch()) session->position = range.captured(1).toLongLong();
+
+    pump(socket);
+}
+
+void StreamBuffer::sessionBytesWritten()
+{
+    pump(qobject_cast<QTcpSocket*>(sender()));
+}
+
+void StreamBuffer::sessionDisconnected()
+{
+    Q_D(StreamBuffer);
+
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    StreamSession *session = d->sessions.take(socket);
+    if(!session) return;
+
+    if(session->upstream)
+    {
+        d->upstreamReplies.remove(session->upstream);
+        disconnect(session->upstream, 0, this, 0);
+        session->upstream->abort();
+        session->upstream->deleteLater();
+    }
+
+    delete session;
+    socket->deleteLater();
+}
+
+void StreamBuffer::upstreamReadyRead()
+{
+    Q_D(StreamBuffer);
+    pump(d->upstreamReplies.value(qobject_cast<QNetworkReply*>(sender()), 0));
+}
+
+void StreamBuffer::upstreamFinished()
+{
+    Q_D(StreamBuffer);
+    pump(d->upstreamReplies.value(qobject_cast<QNetworkReply*>(sender()), 0));
+}
+
+void StreamBuffer::pump(QTcpSocket *socket)
+{
+    Q_D(StreamBuffer);
+
+    StreamSession *session = d->sessions.value(socket, 0);
+    if(!session || session->videoID.isEmpty()) return;
+
+    const StreamPrefix prefix = d->prefixes.value(session->videoID);
+    const bool buffered = d->prefixes.contains(session->videoID) && !prefix.failed;
+
+    if(!session->headersSent && !session->upstream)
+    {
+        //The prefetch answer tells the stream size, without it the live request does
+        if(buffered && !prefix.total && !prefix.finished) return;
+
+        const qint64 prefixEnd = prefix.finished ? prefix.data.size() : d->trackBudget;
+        if(buffered && prefix.total && session->position < prefixEnd)
+        {
+            writeHeaders(socket, prefix.total, prefix.contentType);
+        }
+        else
+        {
+            startUpstream(socket);
+            return;
+        }
+    }
+
+    //Read ahead bytes first, the prefetch may still be filling them
+    if(!session->upstream && buffered)
+    {
+        while(socket->bytesToWrite() < SOCKET_WRITE_LIMIT && session->position < prefix.data.size())
+        {
+            QByteArray chunk = prefix.data.mid(session->position, WRITE_CHUNK_SIZE);
+            socket->write(chunk);
+            session->position += chunk.size();
+        }
+
+        if(session->position < prefix.data.size() || !prefix.finished) return;
+    }
+
+    if(prefix.total && session->position >= prefix.total)
+    {
+        socket->disconnectFromHost();
+        return;
+    }
+
+    //Handing off to the live stream where the buffer ends
+    if(!session->upstream)
+    {
+        startUpstream(socket);
+        return;
+    }
+
+    if(!session->upstreamChecked)
+    {
+        int status = session->upstream->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if(!status && !session->upstream->isFinished()) return;
+
+        if(!session->headersSent)
+        {
+            //VLC follows the redirect itself, the buffer is already past its use
+            if(status >= 300 && status < 400 && session->upstream->hasRawHeader("Location"))
+            {
+                socket->write("HTTP/1.1 302 Found\r\nLocation: " + session->upstream->rawHeader("Location") + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                socket->disconnectFromHost();
+                return;
+            }
+
+            if(status != 200 && status != 206)
+            {
+                socket->write("HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                socket->disconnectFromHost();
+                return;
+            }
+        }
+
+        //An upstream ignoring the range restarts from the first byte, splicing that in would corrupt the stream so VLC reconnects instead
+        if(session->position > 0 && status != 206)
+        {
+            qDebug() << "Stream buffer upstream ignored the range" << session->videoID << status;
+            socket->abort();
+            return;
+        }
+
+        if(!session->headersSent) writeHeaders(socket, replyTotalSize(session->upstream, session->position), session->upstream->header(QNetworkRequest::ContentTypeHeader).toString());
+        session->upstreamChecked = true;
+    }
+
+    while(socket->bytesToWrite() < SOCKET_WRITE_LIMIT && session->upstream->bytesAvailable())
+    {
+        QByteArray chunk = session->upstream->read(WRITE_CHUNK_SIZE);
+        socket->write(chunk);
+        session->position += chunk.size();
+    }
+
+    if(session->upstream->isFinished() && !session->upstream->bytesAvailable()) socket->disconnectFromHost();
+}
+
+void StreamBuffer::pumpWaitingSessions(const QString &videoID)
+{
+    Q_D(StreamBuffer);
+
+    foreach(QTcpSocket *socket, d->sessions.keys())
+    {
+        if(d->sessions.value(socket)->videoID == videoID && !d->sessions.value(socket)->upstream) pump(socket);
+    }
+}
+
+void StreamBuffer::startUpstream(QTcpSocket *socket)
+{
+    Q_D(StreamBuffer);
+
+    StreamSession *session = d->sessions.value(socket, 0);
+    if(!session || session->upstream) return;
+
+    QNetworkRequest request(session->url);
+    if(session->position) request.setRawHeader("Range", "bytes=" + QByteArray::number(session->position) + "-");
+
+    session->upstream = d->networkManager->get(request);
+    d->upstreamReplies.insert(session->upstream, socket);
+
+    //Reading stops while VLC has enough queued, the socket drives the download
+    session->upstream->setReadBufferSize(SOCKET_WRITE_LIMIT);
+
+    connect(session->upstream, SIGNAL(metaDataChanged()), SLOT(upstreamReadyRead()));
+    connect(session->upstream, SIGNAL(readyRead()), SLOT(upstreamReadyRead()));
+    connect(session->upstream, SIGNAL(finished()), SLOT(upstreamFinished()));
+}
+
+void StreamBuffer::writeHeaders(QTcpSocket *socket, const qint64 &total, const QString &contentType)
+{
+    Q_D(StreamBuffer);
+
+    StreamSession *session = d->sessions.value(socket, 0);
+    if(!session) return;
+
+    QByteArray headers;
+    if(session->position && total)
+    {
+        headers.append("HTTP/1.1 206 Partial Content\r\n");
+        headers.append("Content-Range: bytes " + QByteArray::number(session->position) + "-" + QByteArray::number(total - 1) + "/" + QByteArray::number(total) + "\r\n");
+    }
+    else
+    {
+        headers.append("HTTP/1.1 200 OK\r\n");
+    }
+
+    if(total) headers.append("Content-Length: " + QByteArray::number(total - session->position) + "\r\n");
+    if(!contentType.isEmpty()) headers.append("Content-Type: " + contentType.toUtf8() + "\r\n");
+    headers.append("Accept-Ranges: bytes\r\n");
+    headers.append("Connection: close\r\n\r\n");
+
+    socket->write(headers);
+    session->headersSent = true;
+}
+
+void StreamBuffer::evict(const qint64 &required)
+{
+    Q_D(StreamBuffer);
+
+    //Oldest prefixes go first, the ones playing or prerolled are kept while anything else can go
+    while(!d->prefixes.isEmpty() && d->reservedBytes() + required > d->budget)
+    {
+        QString oldestID;
+        foreach(QString videoID, d->prefixes.keys())
+        {
+            if(videoID == d->playingID || videoID == d->prerollID) continue;
+            if(oldestID.isEmpty() || d->prefixes.value(videoID).created < d->prefixes.value(oldestID).created) oldestID = videoID;
+        }
+
+        if(oldestID.isEmpty())
+        {
+            foreach(QString videoID, d->prefixes.keys())
+            {
+                if(oldestID.isEmpty() || d->prefixes.value(videoID).created < d->prefixes.value(oldestID).created) oldestID = videoID;
+            }
+        }
+
+        QNetworkReply *reply = d->prefixes.value(oldestID).reply;
+        if(reply)
+        {
+            d->prefixReplies.remove(reply);
+            disconnect(reply, 0, this, 0);
+            reply->abort();
+            reply->deleteLater();
+        }
+
+        d->prefixes.remove(oldestID);
+    }
+
+    emit statisticsChanged();
+}
@@ -0,0 +1,88 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <QObject>
+#include <QtQml>
+
+class QTcpSocket;
+
+class StreamBufferPrivate;
+class StreamBuffer : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(qint64 budget READ budget WRITE setBudget NOTIFY statisticsChanged)
+    Q_PROPERTY(qint64 trackBudget READ trackBudget WRITE setTrackBudget NOTIFY statisticsChanged)
+    Q_PROPERTY(qint64 bufferedBytes READ bufferedBytes NOTIFY statisticsChanged)
+    Q_PROPERTY(int hits READ hits NOTIFY statisticsChanged)
+    Q_PROPERTY(int misses READ misses NOTIFY statisticsChanged)
+    Q_PROPERTY(double hitRate READ hitRate NOTIFY statisticsChanged)
+    Q_PROPERTY(int bufferedTimeToFirstAudio READ bufferedTimeToFirstAudio NOTIFY statisticsChanged)
+    Q_PROPERTY(int liveTimeToFirstAudio READ liveTimeToFirstAudio NOTIFY statisticsChanged)
+
+public:
+    static StreamBuffer* singleton();
+    static void declareQML();
+
+    void prefetch(const QString& videoID, const QString& url);
+    QString playbackUrl(const QString& videoID, const QString& url);
+    QString prerollUrl(const QString& videoID, const QString& url);
+    void prerollPlayed(const QString& videoID);
+    bool contains(const QString& videoID) const;
+
+    qint64 budget() const;
+    void setBudget(const qint64& budget);
+
+    qint64 trackBudget() const;
+    void setTrackBudget(const qint64& budget);
+
+    qint64 bufferedBytes() const;
+
+    int hits() const;
+    int misses() const;
+    double hitRate() const;
+    int bufferedTimeToFirstAudio() const;
+    int liveTimeToFirstAudio() const;
+
+    Q_INVOKABLE void reportFirstAudio(const int& msecs);
+
+signals:
+    void statisticsChanged();
+
+private slots:
+    void newConnection();
+    void prefetchMetaDataChanged();
+    void prefetchReadyRead();
+    void prefetchFinished();
+    void sessionReadyRead();
+    void sessionBytesWritten();
+    void sessionDisconnected();
+    void upstreamReadyRead();
+    void upstreamFinished();
+
+private:
+    explicit StreamBuffer(QObject *parent = 0);
+    virtual ~StreamBuffer();
+
+    void pump(QTcpSocket *socket);
+    void pumpWaitingSessions(const QString& videoID);
+    void startUpstream(QTcpSocket *socket);
+    void writeHeaders(QTcpSocket *socket, const qint64& total, const QString& contentType);
+    void evict(const qint64& required);
+
+    static StreamBuffer *_singleton;
+
+    Q_DECLARE_PRIVATE(StreamBuffer)
+    StreamBufferPrivate * const d_ptr;
+
+};
+
+static QObject *qmlStreamBufferSingleton(QQmlEngine *engine, QJSEngine *scriptEngine)
+{
+    Q_UNUSED(engine)
+    Q_UNUSED(scriptEngine)
+
+    return StreamBuffer::singleton();
+}
+
+#endif // STREAMBUFFER_H
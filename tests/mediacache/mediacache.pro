@@ -0,0 +1,16 @@
+QT += qml network testlib
+QT -= gui
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_mediacache
+
+INCLUDEPATH += ../..
+
+HEADERS += ../../mediacache.h \
+    ../../playlistsmanager.h
+
+SOURCES += tst_mediacache.cpp \
+    playlistsmanagerstub.cpp \
+    ../../mediacache.cpp
@@ -0,0 +1,144 @@
+#include "playlistsmanager.h"
+
+#include <QJsonDocument>
+#include <QSet>
+
+//Stand-in for the library, the cache only asks it which videos are favorites or in a playlist
+class PlaylistsManagerPrivate
+{
+public:
+    QSet<QString> favorites;
+};
+
+PlaylistsManager *PlaylistsManager::_singleton = 0;
+
+PlaylistsManager::PlaylistsManager(QObject *parent) :
+    QObject(parent),
+    d_ptr(new PlaylistsManagerPrivate)
+{
+}
+
+PlaylistsManager::~PlaylistsManager()
+{
+    delete d_ptr;
+}
+
+PlaylistsManager *PlaylistsManager::singleton()
+{
+    if(!_singleton)
+    {
+        _singleton = new PlaylistsManager;
+    }
+    return _singleton;
+}
+
+bool PlaylistsManager::isFavorited(const QString &id) const
+{
+    Q_D(const PlaylistsManager);
+    return d->favorites.contains(id);
+}
+
+void PlaylistsManager::addFavorite(const QString &id, const QString &title, const QString &subTitle, const QString &thumbnail,
+                                   const QString &duration, QString timestamp)
+{
+    Q_D(PlaylistsManager);
+
+    Q_UNUSED(title)
+    Q_UNUSED(subTitle)
+    Q_UNUSED(thumbnail)
+    Q_UNUSED(duration)
+    Q_UNUSED(timestamp)
+
+    d->favorites.insert(id);
+    emit favoritesChanged();
+}
+
+bool PlaylistsManager::removeFavorite(const QString &id)
+{
+    Q_D(PlaylistsManager);
+
+    if(!d->favorites.remove(id)) return false;
+
+    emit favoritesChanged();
+    return true;
+}
+
+void PlaylistsManager::removeFavorites(const QStringList &ids)
+{
+    foreach(QString id, ids)
+    {
+        removeFavorite(id);
+    }
+}
+
+QList<QObject *> PlaylistsManager::favorites() const
+{
+    return QList<QObject*>();
+}
+
+Playlist *PlaylistsManager::createPlaylist(const QString &name)
+{
+    Q_UNUSED(name)
+    return 0;
+}
+
+bool PlaylistsManager::deletePlaylist(const QString &name)
+{
+    Q_UNUSED(name)
+    return false;
+}
+
+QList<QString> PlaylistsManager::playlistNames() const
+{
+    return QList<QString>();
+}
+
+Playlist *PlaylistsManager::playlist(const QString &name) const
+{
+    Q_UNUSED(name)
+    return 0;
+}
+
+QStringList PlaylistsManager::itemPlaylists(const QString &id, const QString &excludingPlaylistName) const
+{
+    Q_UNUSED(id)
+    Q_UNUSED(excludingPlaylistName)
+    return QStringList();
+}
+
+void PlaylistsManager::playlistNameChanged(const QString &name, const QString &oldName)
+{
+    Q_UNUSED(name)
+    Q_UNUSED(oldName)
+}
+
+void PlaylistsManager::playlistItemAdded(VideoItem *videoItem)
+{
+    Q_UNUSED(videoItem)
+}
+
+void PlaylistsManager::playlistItemsAdded(QList<VideoItem *> videoItems)
+{
+    Q_UNUSED(videoItems)
+}
+
+void PlaylistsManager::playlistItemRemoved(const QString &id)
+{
+    Q_UNUSED(id)
+}
+
+void PlaylistsManager::playlistItemsRemoved(const QStringList &ids)
+{
+    Q_UNUSED(ids)
+}
+
+void PlaylistsManager::videoDurationResolved(const QString &id, const QString &duration)
+{
+    Q_UNUSED(id)
+    Q_UNUSED(duration)
+}
+
+void PlaylistsManager::emitFavoritesChanged()
+{
+    emit favoritesChanged();
+}
@@ -0,0 +1,217 @@
+#include "mediacache.h"
+#include "playlistsmanager.h"
+
+#include <QtTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+
+#define MEDIA_BODY "beatwhale media cache payload"
+
+//Local stand-in for the media host, /media answers the payload and anything else 404
+class MediaServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit MediaServer(QObject *parent = 0) : QTcpServer(parent)
+    {
+        connect(this, SIGNAL(newConnection()), SLOT(acceptConnections()));
+    }
+
+    QString url(const QString& path) const
+    {
+        return QString("http://127.0.0.1:%1/%2").arg(serverPort()).arg(path);
+    }
+
+private slots:
+    void acceptConnections()
+    {
+        while(hasPendingConnections())
+        {
+            QTcpSocket *socket = nextPendingConnection();
+            connect(socket, SIGNAL(readyRead()), SLOT(answer()));
+            connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        }
+    }
+
+    void answer()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+        if(!socket) return;
+
+        QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+        socket->setProperty("request", request);
+        if(!request.contains("\r\n\r\n")) return;
+
+        if(request.startsWith("GET /media "))
+        {
+            QByteArray body(MEDIA_BODY);
+            socket->write("HTTP/1.1 200 OK\r\nContent-Length: " + QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+        }
+        else
+        {
+            socket->write("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        }
+        socket->disconnectFromHost();
+    }
+};
+
+class MediaCacheTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void storeDownloadsEntry();
+    void storeSkipsFailedDownload();
+    void containsRespectsEnabled();
+    void fileHitDefersIndexSave();
+    void evictionPinsFavorites();
+
+private:
+    qint64 indexedAccess(const QString& indexPath, const QString& videoID) const;
+    bool storeEntry(const QString& videoID);
+
+    QTemporaryDir settingsDir;
+    MediaServer server;
+};
+
+void MediaCacheTest::initTestCase()
+{
+    QVERIFY(settingsDir.isValid());
+
+    //The cache lives next to the local settings, pointing those at a temporary directory keeps the run isolated
+    QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, settingsDir.path());
+
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    MediaCache::singleton()->setEnabled(true);
+    QVERIFY(MediaCache::singleton()->isEnabled());
+}
+
+void MediaCacheTest::storeDownloadsEntry()
+{
+    MediaCache *cache = MediaCache::singleton();
+    QSignalSpy storedSpy(cache, SIGNAL(stored(QString)));
+
+    cache->store("video1", "140", "m4a", server.url("media"));
+
+    QVERIFY(storedSpy.wait(5000));
+    QCOMPARE(storedSpy.first().first().toString(), QString("video1"));
+    QVERIFY(cache->contains("video1"));
+
+    QFile file(cache->file("video1"));
+    QVERIFY(file.open(QFile::ReadOnly));
+    QCOMPARE(file.readAll(), QByteArray(MEDIA_BODY));
+    QCOMPARE(cache->size(), qint64(QByteArray(MEDIA_BODY).size()));
+}
+
+void MediaCacheTest::storeSkipsFailedDownload()
+{
+    MediaCache *cache = MediaCache::singleton();
+    int count = cache->count();
+
+    cache->store("video2", "140", "m4a", server.url("missing"));
+
+    QTRY_COMPARE(cache->pendingDownloads(), 0);
+    QVERIFY(!cache->contains("video2"));
+    QCOMPARE(cache->count(), count);
+}
+
+void MediaCacheTest::containsRespectsEnabled()
+{
+    MediaCache *cache = MediaCache::singleton();
+    QVERIFY(cache->contains("video1"));
+
+    cache->setEnabled(false);
+    QVERIFY(!cache->contains("video1"));
+    QVERIFY(cache->file("video1").isEmpty());
+
+    cache->setEnabled(true);
+    QVERIFY(cache->contains("video1"));
+}
+
+void MediaCacheTest::fileHitDefersIndexSave()
+{
+    MediaCache *cache = MediaCache::singleton();
+
+    QString filePath = cache->file("video1");
+    QVERIFY(!filePath.isEmpty());
+    QString indexPath = QFileInfo(filePath).path() + "/index.json";
+
+    cache->saveIndex();
+    qint64 storedAccess = indexedAccess(indexPath, "video1");
+    QVERIFY(storedAccess > 0);
+
+    //A hit only marks the index dirty, the write waits for the save timer
+    QTest::qWait(20);
+    QCOMPARE(cache->file("video1"), filePath);
+    QCOMPARE(indexedAccess(indexPath, "video1"), storedAccess);
+
+    cache->saveIndex();
+    QVERIFY(indexedAccess(indexPath, "video1") > storedAccess);
+}
+
+void MediaCacheTest::evictionPinsFavorites()
+{
+    MediaCache *cache = MediaCache::singleton();
+    const qint64 entrySize = QByteArray(MEDIA_BODY).size();
+    const qint64 maximumSize = cache->maximumSize();
+
+    cache->clear();
+    QCOMPARE(cache->size(), qint64(0));
+
+    //Room for two entries, the favorite is the oldest but pinned so the next oldest goes
+    cache->setMaximumSize(2 * entrySize);
+    PlaylistsManager::singleton()->addFavorite("pinned", "Pinned", "", "", "");
+
+    QVERIFY(storeEntry("pinned"));
+    QVERIFY(storeEntry("older"));
+    QVERIFY(storeEntry("newer"));
+
+    QVERIFY(cache->contains("pinned"));
+    QVERIFY(!cache->contains("older"));
+    QVERIFY(cache->contains("newer"));
+    QCOMPARE(cache->size(), 2 * entrySize);
+
+    //Shrinking the budget still keeps the favorite over a more recent entry
+    cache->setMaximumSize(entrySize);
+    QVERIFY(cache->contains("pinned"));
+    QVERIFY(!cache->contains("newer"));
+
+    //With nothing else left over the budget the favorite goes too
+    cache->setMaximumSize(0);
+    QVERIFY(!cache->contains("pinned"));
+    QCOMPARE(cache->size(), qint64(0));
+
+    PlaylistsManager::singleton()->removeFavorite("pinned");
+    cache->setMaximumSize(maximumSize);
+}
+
+qint64 MediaCacheTest::indexedAccess(const QString &indexPath, const QString &videoID) const
+{
+    QFile indexFile(indexPath);
+    if(!indexFile.open(QFile::ReadOnly)) return 0;
+
+    QJsonObject entryObj = QJsonDocument::fromJson(indexFile.readAll()).object().value(videoID).toObject();
+    return entryObj.value("accessed").toString().toLongLong();
+}
+
+bool MediaCacheTest::storeEntry(const QString &videoID)
+{
+    MediaCache *cache = MediaCache::singleton();
+    QSignalSpy storedSpy(cache, SIGNAL(stored(QString)));
+
+    //Accesses are stamped in milliseconds, keep them apart so the order is unambiguous
+    QTest::qWait(5);
+    cache->store(videoID, "140", "m4a", server.url("media"));
+    return storedSpy.wait(5000);
+}
+
+QTEST_MAIN(MediaCacheTest)
+
+#include "tst_mediacache.moc"
@@ -4,29 +4,173 @@
 #include "applicationmanager.h"
 #include "videoitem.h"
 #include "youtubeapimanager.h"
+#include "videodetailsstore.h"
+#include "deadlinescheduler.h"
 
 #include <couchdb.h>
-#include <couchdblistener.h>
 
 #include <QFile>
+#include <QNetworkReply>
+#include <QUrlQuery>
+#include <QJsonDocument>
+#include <QJsonArray>
 #include <QTextStream>
+#include <QUuid>
+#include <QSet>
+#include <QTimer>
+#include <QDateTime>
 #include <QtQml>
 #include <QDebug>
 
+#define INDEX_DOCUMENT "index"
+#define FAVORITES_DOCUMENT "favorites"
+#define LEGACY_DOCUMENT "videos"
+#define PLAYLIST_DOCUMENT_PREFIX "playlist_"
+#define SYNC_QUIET_PERIOD 1000
+#define SYNC_MAXIMUM_LATENCY 5000
+#define SYNC_RETRY_DELAY 1000
+#define SYNC_RETRY_MAXIMUM 60000
+#define CHANGES_HEARTBEAT 30000
+#define LOGOUT_UPLOAD_TIMEOUT 3000
+
 UserManager *UserManager::_singleton = 0;
 
+//A single library edit, replayed on top of the server revision until it is acknowledged
+struct SyncOperation
+{
+    enum Type
+    {
+        OPERATION_ADD_ITEM,         //key: item ID, value: item
+        OPERATION_REMOVE_ITEM,      //key: item ID
+        OPERATION_ADD_PLAYLIST,     //key: playlist name, value: document ID
+        OPERATION_REMOVE_PLAYLIST,  //key: playlist name
+        OPERATION_RENAME_PLAYLIST,  //key: old name, empty inside the playlist document itself, value: new name
+        OPERATION_DELETE_PLAYLIST
+    };
+
+    SyncOperation(const Type& type, const QString& key, const QJsonValue& value = QJsonValue()) :
+        type(type),
+        key(key),
+        value(value)
+    {}
+
+    void apply(QJsonObject& content) const
+    {
+        switch(type)
+        {
+        case OPERATION_ADD_ITEM:
+        case OPERATION_REMOVE_ITEM:
+        {
+            QJsonObject itemsObj = content.value("items").toObject();
+            if(type == OPERATION_ADD_ITEM) itemsObj.insert(key, value);
+            else itemsObj.remove(key);
+            content.insert("items", itemsObj);
+            break;
+        }
+        case OPERATION_ADD_PLAYLIST:
+        case OPERATION_REMOVE_PLAYLIST:
+        {
+            //A name another device already created keeps its document, the items are merged into that one
+            QJsonObject playlistsObj = content.value("playlists").toObject();
+            if(type == OPERATION_ADD_PLAYLIST && !playlistsObj.contains(key)) playlistsObj.insert(key, value);
+            else if(type == OPERATION_REMOVE_PLAYLIST) playlistsObj.remove(key);
+            content.insert("playlists", playlistsObj);
+            break;
+        }
+        case OPERATION_RENAME_PLAYLIST:
+        {
+            if(key.isEmpty())
+            {
+                content.insert("name", value);
+                break;
+            }
+
+            //Already removed on another device, there is nothing left to rename
+            QJsonObject playlistsObj = content.value("playlists").toObject();
+            if(!playlistsObj.contains(key)) break;
+
+            playlistsObj.insert(value.toString(), playlistsObj.take(key));
+            content.insert("playlists", playlistsObj);
+            break;
+        }
+        case OPERATION_DELETE_PLAYLIST:
+            content = QJsonObject();
+            content.insert("deleted", true);
+            break;
+        }
+    }
+
+    Type type;
+    QString key;
+    QJsonValue value;
+};
+
+//One CouchDB document of the user library, the index, the favorites or a single playlist
+struct SyncDocument
+{
+    SyncDocument() :
+        sentOperations(0),
+        loaded(false),
+        stored(false),
+        uploading(false),
+        waitingForChanges(false)
+    {}
+
+    //The server revision with the pending edits replayed on top
+    QJsonObject localContent() const
+    {
+        QJsonObject obj = content;
+        foreach(SyncOperation operation, operations)
+        {
+            operation.apply(obj);
+        }
+        return obj;
+    }
+
+    bool readyForUpload() const
+    {
+        return operations.count() > sentOperations || (loaded && !stored);
+    }
+
+    QString revision;
+    QSet<QString> ownRevisions;
+    QString announcedRevision;
+    QJsonObject content;
+    QList<SyncOperation> operations;
+    int sentOperations;
+    bool loaded;
+    bool stored;
+    bool uploading;
+    bool waitingForChanges;
+};
+
 class UserManagerPrivate
 {
 public:
     UserManagerPrivate() :
         networkManager(0),
         connectionIsDown(false),
+        serverUrl("https://beatwhale.cloudant.com"),
+        changesReply(0),
+        changesRetryDelay(SYNC_RETRY_DELAY),
         couchDB(0),
-        videosListener(0),
         queueFile(0),
         firstTime(true),
-        waitingForChanges(false),
-        documentReadyForUpload(false),
+        sharded(false),
+        flushTimer(0),
+        retryTimer(0),
+        logoutTimer(0),
+        retryDelay(SYNC_RETRY_DELAY),
+        quietPeriod(SYNC_QUIET_PERIOD),
+        maximumLatency(SYNC_MAXIMUM_LATENCY),
+        pendingMutations(0),
+        firstPendingMutation(0),
+        uploadsInFlight(0),
+        mutations(0),
+        uploads(0),
+        uploadedBytes(0),
+        refetches(0),
+        avoidedRefetches(0),
         localSettings(QSettings::IniFormat, QSettings::UserScope, "BeatWhale", "beatwhale_app")
     {
     }
@@ -34,8 +178,6 @@ public:
     virtual ~UserManagerPrivate()
     {
         if(networkManager) delete networkManager;
-
-        if(videosListener) delete videosListener;
         if(couchDB) delete couchDB;
 
         if(queueFile)
@@ -48,8 +190,121 @@ public:
     QNetworkAccessManager *networkManager;
     bool connectionIsDown;
 
+    QString serverUrl;
+    QNetworkReply *changesReply;
+    QString changesSequence;
+    int changesRetryDelay;
+
+    QString database() const
+    {
+        return "u_" + username.toLower();
+    }
+
+    //CouchDB answers a document that was never written with a not_found error
+    static bool documentMissing(const CouchDBResponse& response)
+    {
+        return response.documentObj().value("error").toString() == "not_found";
+    }
+
+    //Only an update written against an outdated revision is rebased on the current one
+    static bool documentConflict(const CouchDBResponse& response)
+    {
+        return response.documentObj().value("error").toString() == "conflict";
+    }
+
+    static QJsonObject documentContent(QJsonObject obj)
+    {
+        obj.remove("_id");
+        obj.remove("_rev");
+        return obj;
+    }
+
+    QJsonValue documentItems(const QString& documentID) const
+    {
+        QJsonValue items = documents.value(documentID).localContent().value("items");
+        return items.isUndefined() ? QJsonValue() : items;
+    }
+
+    //A playlist not known to the index yet gets a document of its own
+    QString playlistDocument(const QString& name)
+    {
+        if(name == "Favorites") return FAVORITES_DOCUMENT;
+
+        QString documentID = playlistDocuments.value(name);
+        if(!documentID.isEmpty()) return documentID;
+
+        documentID = PLAYLIST_DOCUMENT_PREFIX + QUuid::createUuid().toString().mid(1, 36);
+        documents[documentID].loaded = true;
+        documents[INDEX_DOCUMENT].operations.append(SyncOperation(SyncOperation::OPERATION_ADD_PLAYLIST, name, documentID));
+        documents[documentID].operations.append(SyncOperation(SyncOperation::OPERATION_RENAME_PLAYLIST, QString(), name));
+
+        refreshPlaylistDocuments();
+        return documentID;
+    }
+
+    //Operations recorded on a playlist document that lost its name to another one go to that one instead
+    void mergePlaylistDocument(const QString& documentID, const QString& targetID)
+    {
+        SyncDocument document = documents.value(documentID);
+        SyncDocument &targetDocument = documents[targetID];
+
+        QJsonObject itemsObj = document.content.value("items").toObject();
+        foreach(QString id, itemsObj.keys())
+        {
+            targetDocument.operations.append(SyncOperation(SyncOperation::OPERATION_ADD_ITEM, id, itemsObj.value(id)));
+        }
+
+        foreach(SyncOperation operation, document.operations)
+        {
+            if(operation.type == SyncOperation::OPERATION_ADD_ITEM || operation.type == SyncOperation::OPERATION_REMOVE_ITEM) targetDocument.operations.append(operation);
+        }
+
+        //Already on the server, the orphan is marked deleted like any removed playlist
+        if(document.stored || document.uploading)
+        {
+            documents[documentID].operations.append(SyncOperation(SyncOperation::OPERATION_DELETE_PLAYLIST, QString()));
+        }
+        else
+        {
+            documents.remove(documentID);
+        }
+    }
+
+    void refreshPlaylistDocuments()
+    {
+        playlistDocuments.clear();
+
+        QJsonObject playlistsObj = documents.value(INDEX_DOCUMENT).localContent().value("playlists").toObject();
+        foreach(QString name, playlistsObj.keys())
+        {
+            playlistDocuments.insert(name, playlistsObj.value(name).toString());
+        }
+    }
+
+    bool uploadPending() const
+    {
+        foreach(SyncDocument document, documents)
+        {
+            if(document.readyForUpload()) return true;
+        }
+        return false;
+    }
+
+    //Every edit is acknowledged by the server, nothing is buffered, uploading or waiting to be replayed
+    bool synced() const
+    {
+        if(pendingMutations || uploadsInFlight) return false;
+
+        foreach(SyncDocument document, documents)
+        {
+            if(!document.operations.isEmpty() || (document.loaded && !document.stored)) return false;
+        }
+        return true;
+    }
+
     CouchDB *couchDB;
-    CouchDBListener *videosListener;
+    QHash<QString, SyncDocument> documents;
+    QHash<QString, QString> playlistDocuments;
 
     QSettings localSettings;
 
@@ -59,12 +314,26 @@ public:
     QString email;
 
     QString currentSettingsRevision;
-    QJsonDocument videosDocument;
-    QJsonDocument documentToUpload;
 
     bool firstTime;
-    bool waitingForChanges;
-    bool documentReadyForUpload;
+    bool sharded;
+
+    QTimer *flushTimer;
+    QTimer *retryTimer;
+    QTimer *logoutTimer;
+    QSet<QString> retryDocuments;
+    QSet<QString> failedUpdates;
+    int retryDelay;
+    int quietPeriod;
+    int maximumLatency;
+    int pendingMutations;
+    qint64 firstPendingMutation;
+    int uploadsInFlight;
+    int mutations;
+    int uploads;
+    qint64 uploadedBytes;
+    int refetches;
+    int avoidedRefetches;
 
     QFile *queueFile;
     QTextStream queueFileStream;
@@ -85,6 +354,25 @@ UserManager::UserManager(QObject *parent) :
     d->couchDB->setServerConfiguration("https://beatwhale.cloudant.com", 80);
     connect(d->couchDB, SIGNAL(documentUpdated(CouchDBResponse)), SLOT(documentUpdated(CouchDBResponse)));
     connect(d->couchDB, SIGNAL(documentRetrieved(CouchDBResponse)), SLOT(documentRetrieved(CouchDBResponse)));
+
+    //Bursts of library edits are written as one upload once they stop, or after the latency bound at most
+    QSettings settings("beatwhale_config.ini", QSettings::IniFormat);
+    d->quietPeriod = settings.value("sync_quiet_period", d->quietPeriod).toInt();
+    d->maximumLatency = settings.value("sync_maximum_latency", d->maximumLatency).toInt();
+
+    d->flushTimer = new QTimer(this);
+    d->flushTimer->setSingleShot(true);
+    connect(d->flushTimer, SIGNAL(timeout()), SLOT(flushDocuments()));
+
+    d->retryTimer = new QTimer(this);
+    d->retryTimer->setSingleShot(true);
+    connect(d->retryTimer, SIGNAL(timeout()), SLOT(retryDocuments()));
+
+    d->logoutTimer = new QTimer(this);
+    d->logoutTimer->setSingleShot(true);
+    connect(d->logoutTimer, SIGNAL(timeout()), SLOT(finishLogout()));
+
+    connect(YoutubeAPIManager::singleton(), SIGNAL(videoDurationSuccess(QString,QString)), SLOT(videoDurationResolved(QString,QString)));
 }
 
 UserManager::~UserManager()
@@ -111,6 +399,7 @@ void UserManager::setServerUrl(const QString &url)
     Q_D(UserManager);
     qDebug() << "Setting server url" << url;
     d->couchDB->setServerConfiguration(url, 80);
+    d->serverUrl = url;
 }
 
 QString UserManager::storedUsername() const
@@ -242,6 +531,7 @@ void UserManager::createAccountVerification(const QString &username, const QStri
     QUrl url(ApplicationManager::singleton()->beatwhaleAPIUrl() + "sendemailactivation.php?email=" + email.toLower() + "&username=" + username + "&code=" + code);
     QNetworkReply *reply = d->networkManager->get(QNetworkRequest(url));
     connect(reply, SIGNAL(finished()), SLOT(createAccountVerificationReply()));
+    DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_ACCOUNT);
 }
 
 void UserManager::createAccountVerificationReply()
@@ -260,7 +550,7 @@ void UserManager::createAccountVerificationReply()
     if(success) emit createAccountVerificationSuccess();
     else emit createAccountVerificationFailed(obj.value("message").toString("Problem connecting to BeatWhale API. Please try again."));
 
-    delete reply;
+    reply->deleteLater();
 }
 
 void UserManager::createAccount(const QString &username, const QString &password, const QString &email)
@@ -280,6 +570,7 @@ void UserManager::createAccount(const QString &username, const QString &password
     QUrl url(ApplicationManager::singleton()->beatwhaleAPIUrl() + "createaccount.php?email=" + email.toLower() + "&username=" + username + "&hash=" + hash + "&salt=" + salt);
     QNetworkReply *reply = d->networkManager->get(QNetworkRequest(url));
     connect(reply, SIGNAL(finished()), SLOT(createAccountReply()));
+    DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_ACCOUNT);
 }
 
 void UserManager::createAccountReply()
@@ -305,7 +596,7 @@ void UserManager::createAccountReply()
         emit createAccountFailed(obj.value("message").toString("Problem connecting to BeatWhale API. Please try again."));
     }
 
-    delete reply;
+    reply->deleteLater();
 }
 
 void UserManager::deleteAccount()
@@ -315,6 +606,7 @@ void UserManager::deleteAccount()
     QUrl url(ApplicationManager::singleton()->beatwhaleAPIUrl() + "deleteaccount.php?email=" + d->email.toLower() + "&username=" + d->username + "&rev=" + d->currentSettingsRevision);
     QNetworkReply *reply = d->networkManager->get(QNetworkRequest(url));
     connect(reply, SIGNAL(finished()), SLOT(deleteAccountReply()));
+    DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_ACCOUNT);
 }
 
 void UserManager::deleteAccountReply()
@@ -330,7 +622,7 @@ void UserManager::deleteAccountReply()
 
     bool success = obj.value("success").toBool();
 
-    delete reply;
+    reply->deleteLater();
 
     if(!success)
     {
@@ -375,6 +667,7 @@ void UserManager::forgotDetails(const QString& email)
     QUrl url(ApplicationManager::singleton()->beatwhaleAPIUrl() + "forgotdetails.php?email=" + email.toLower() + "&password=" + d->newPassword + "&hash=" + hash + "&salt=" + salt);
     QNetworkReply *reply = d->networkManager->get(QNetworkRequest(url));
     connect(reply, SIGNAL(finished()), SLOT(forgotDetailsReply()));
+    DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_ACCOUNT);
 }
 
 void UserManager::forgotDetailsReply()
@@ -391,7 +684,7 @@ void UserManager::forgotDetailsReply()
     bool success = obj.value("success").toBool();
 
     d->newPassword = "";
-    delete reply;
+    reply->deleteLater();
 
     if(!success)
     {
@@ -422,6 +715,7 @@ void UserManager::changePassword(const QString &newPassword)
     QUrl url(ApplicationManager::singleton()->beatwhaleAPIUrl() + "changepassword.php?username=" + d->username + "&hash=" + hash + "&salt=" + salt + "&rev=" + d->currentSettingsRevision);
     QNetworkReply *reply = d->networkManager->get(QNetworkRequest(url));
     connect(reply, SIGNAL(finished()), SLOT(changePasswordReply()));
+    DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_ACCOUNT);
 }
 
 void UserManager::changePasswordReply()
@@ -437,7 +731,7 @@ void UserManager::changePasswordReply()
 
     bool success = obj.value("success").toBool();
 
-    delete reply;
+    reply->deleteLater();
 
     if(!success)
     {
@@ -515,6 +809,10 @@ void UserManager::loginReply(const CouchDBResponse& response)
             item.setThumbnail(itemData[3]);
             item.setDuration(itemData[4]);
 
+            VideoDetailsStore::singleton()->insert(itemData[0], QString(), itemData[3], itemData[4]);
+            YoutubeAPIManager::singleton()->addQueuedID(itemData[0]);
+            if(itemData[4].isEmpty()) YoutubeAPIManager::singleton()->videoDuration(itemData[0]);
+
             emit queueItemAdded(&item);
         }
     }
@@ -528,6 +826,28 @@ void UserManager::logout()
 {
     Q_D(UserManager);
 
+    if(d->logoutTimer->isActive()) return;
+
+    //In-flight uploads and queued edits would be lost with the sync state, give them a bounded time to land
+    if(flushDocuments())
+    {
+        connect(this, SIGNAL(uploadsFinished()), SLOT(finishLogout()), Qt::ConnectionType(Qt::QueuedConnection | Qt::UniqueConnection));
+        d->logoutTimer->start(LOGOUT_UPLOAD_TIMEOUT);
+        return;
+    }
+
+    finishLogout();
+}
+
+void UserManager::finishLogout()
+{
+    Q_D(UserManager);
+
+    disconnect(this, SIGNAL(uploadsFinished()), this, SLOT(finishLogout()));
+    d->logoutTimer->stop();
+
+    if(!d->queueFile) return;
+
     stopListeningToChanges();
 
     d->username = "";
@@ -538,6 +858,7 @@ void UserManager::logout()
     d->queueFile->close();
     delete d->queueFile;
     d->queueFile = 0;
+    YoutubeAPIManager::singleton()->clearQueuedIDs();
 
     d->firstTime = true;
 }
@@ -549,6 +870,7 @@ void UserManager::removedFromQueue(const int &index)
     d->queueFileStream.seek(0);
     d->queueFile->resize(0);
 
+    if(index >= 0 && index < d->queueStringList.count()) YoutubeAPIManager::singleton()->removeQueuedID(d->queueStringList.at(index).section("#!#!", 0, 0));
     d->queueStringList.removeAt(index);
 
     foreach(QString string, d->queueStringList)
@@ -560,17 +882,48 @@ void UserManager::removedFromQueue(const int &index)
 void UserManager::addedToQueue(const QString &id, const QString &title, const QString &subTitle, const QString &thumbnail, const QString &duration)
 {
     Q_D(UserManager);
+    VideoDetailsStore::singleton()->insert(id, QString(), thumbnail, duration);
+    YoutubeAPIManager::singleton()->addQueuedID(id);
+
     QString itemString(id + "#!#!" + title + "#!#!" + subTitle + "#!#!" + thumbnail + "#!#!" + duration);
     d->queueStringList.append(itemString);
     d->queueFileStream << itemString << endl;
 }
 
+void UserManager::videoDurationResolved(const QString &id, const QString &duration)
+{
+    Q_D(UserManager);
+
+    if(!d->queueFile || duration.isEmpty()) return;
+
+    bool queueChanged = false;
+    for(int i = 0; i < d->queueStringList.count(); ++i)
+    {
+        QStringList itemData = d->queueStringList.at(i).split("#!#!");
+        if(itemData.count() != 5 || itemData[0] != id || !itemData[4].isEmpty()) continue;
+
+        itemData[4] = duration;
+        d->queueStringList[i] = itemData.join("#!#!");
+        queueChanged = true;
+    }
+    if(!queueChanged) return;
+
+    d->queueFileStream.seek(0);
+    d->queueFile->resize(0);
+
+    foreach(QString string, d->queueStringList)
+    {
+        d->queueFileStream << string << endl;
+    }
+}
+
 void UserManager::queueCleared()
 {
     Q_D(UserManager);
     d->queueFileStream.seek(0);
     d->queueFile->resize(0);
     d->queueStringList.clear();
+    YoutubeAPIManager::singleton()->clearQueuedIDs();
 }
 
 qreal UserManager::volume()
@@ -596,11 +949,17 @@ void UserManager::startListeningToChanges()
 {
     Q_D(UserManager);
 
-    if(d->username.count())
-    {
-        d->videosListener = d->couchDB->createListener("u_" + d->username.toLower(), "videos");
-        connect(d->videosListener, SIGNAL(changesMade(QString)), SLOT(changesMade(QString)));
-    }
+    if(!d->username.count()) return;
+
+    d->sharded = d->localSettings.value(d->username + "-general/sharded_documents", false).toBool();
+
+    //One changes feed for the whole database, the documents followed are picked out of it by ID
+    d->changesSequence = "now";
+    listenToChanges();
+
+    //The index only has to be looked for once, accounts without it still use the single videos document
+    if(d->sharded) listenToDocument(INDEX_DOCUMENT);
+    else d->couchDB->retrieveDocument(d->database(), INDEX_DOCUMENT);
 }
 
 bool UserManager::stopListeningToChanges()
@@ -609,49 +968,394 @@ bool UserManager::stopListeningToChanges()
 
     if(d->username.count())
     {
-        delete d->videosListener;
-        d->videosListener = 0;
+        if(d->changesReply)
+        {
+            disconnect(d->changesReply, 0, this, 0);
+            d->changesReply->abort();
+            d->changesReply->deleteLater();
+            d->changesReply = 0;
+        }
+        d->changesSequence.clear();
+        d->changesRetryDelay = SYNC_RETRY_DELAY;
+
+        d->documents.clear();
+        d->playlistDocuments.clear();
+
+        d->flushTimer->stop();
+        d->retryTimer->stop();
+        d->retryDocuments.clear();
+        d->failedUpdates.clear();
+        d->retryDelay = SYNC_RETRY_DELAY;
+        d->pendingMutations = 0;
+        d->uploadsInFlight = 0;
     }
     return false;
 }
 
-void UserManager::updateDocument(const QJsonDocument &document)
+void UserManager::recordPlaylistAdded(const QString &name)
+{
+    Q_D(UserManager);
+
+    if(d->playlistDocuments.contains(name)) return;
+
+    d->playlistDocument(name);
+    mutationRecorded();
+}
+
+void UserManager::recordPlaylistRenamed(const QString &oldName, const QString &name)
+{
+    Q_D(UserManager);
+
+    QString documentID = d->playlistDocuments.value(oldName);
+    if(documentID.isEmpty())
+    {
+        recordPlaylistAdded(name);
+        return;
+    }
+
+    //The document keeps its ID, only the index entry and the name inside it change
+    d->documents[INDEX_DOCUMENT].operations.append(SyncOperation(SyncOperation::OPERATION_RENAME_PLAYLIST, oldName, name));
+    d->documents[documentID].operations.append(SyncOperation(SyncOperation::OPERATION_RENAME_PLAYLIST, QString(), name));
+    d->refreshPlaylistDocuments();
+
+    mutationRecorded();
+}
+
+void UserManager::recordPlaylistRemoved(const QString &name)
+{
+    Q_D(UserManager);
+
+    QString documentID = d->playlistDocuments.value(name);
+    if(documentID.isEmpty()) return;
+
+    d->documents[INDEX_DOCUMENT].operations.append(SyncOperation(SyncOperation::OPERATION_REMOVE_PLAYLIST, name));
+    d->documents[documentID].operations.append(SyncOperation(SyncOperation::OPERATION_DELETE_PLAYLIST, QString()));
+    d->refreshPlaylistDocuments();
+
+    mutationRecorded();
+}
+
+void UserManager::recordItemAdded(const QString &playlistName, const QString &id, const QJsonValue &item)
+{
+    Q_D(UserManager);
+
+    QString documentID = d->playlistDocument(playlistName);
+    d->documents[documentID].operations.append(SyncOperation(SyncOperation::OPERATION_ADD_ITEM, id, item));
+
+    mutationRecorded();
+}
+
+void UserManager::recordItemRemoved(const QString &playlistName, const QString &id)
+{
+    Q_D(UserManager);
+
+    QString documentID = d->playlistDocument(playlistName);
+    d->documents[documentID].operations.append(SyncOperation(SyncOperation::OPERATION_REMOVE_ITEM, id));
+
+    mutationRecorded();
+}
+
+void UserManager::mutationRecorded()
+{
+    Q_D(UserManager);
+
+    //Bursts of edits go out as one upload per document once they stop
+    ++d->mutations;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if(!d->pendingMutations++) d->firstPendingMutation = now;
+
+    int remaining = d->maximumLatency - int(now - d->firstPendingMutation);
+    d->flushTimer->start(qMax(0, qMin(d->quietPeriod, remaining)));
+}
+
+bool UserManager::flushDocuments()
+{
+    Q_D(UserManager);
+
+    d->flushTimer->stop();
+
+    if(d->pendingMutations)
+    {
+        d->pendingMutations = 0;
+        uploadDocument();
+    }
+
+    return !d->synced();
+}
+
+QVariantMap UserManager::syncStatistics() const
+{
+    Q_D(const UserManager);
+
+    QVariantMap statistics;
+    statistics.insert("mutations", d->mutations);
+    statistics.insert("uploads", d->uploads);
+    statistics.insert("mutationsPerUpload", d->uploads ? double(d->mutations) / d->uploads : 0.0);
+    statistics.insert("uploadedBytes", d->uploadedBytes);
+    statistics.insert("pendingMutations", d->pendingMutations);
+    statistics.insert("refetches", d->refetches);
+    statistics.insert("avoidedRefetches", d->avoidedRefetches);
+    return statistics;
+}
+
+void UserManager::stageDocuments(const QJsonObject &obj)
 {
     Q_D(UserManager);
 
-    d->documentToUpload = document;
-    d->documentReadyForUpload = true;
+    //Every playlist of the old document becomes one of its own, its items are added there
+    foreach(QString name, obj.keys())
+    {
+        if(name == "_id" || name == "_rev") continue;
+
+        QString documentID = d->playlistDocument(name);
+        QJsonObject itemsObj = obj.value(name).toObject();
+        foreach(QString id, itemsObj.keys())
+        {
+            d->documents[documentID].operations.append(SyncOperation(SyncOperation::OPERATION_ADD_ITEM, id, itemsObj.value(id)));
+        }
+    }
 
     uploadDocument();
 }
 
+void UserManager::listenToDocument(const QString &documentID)
+{
+    Q_D(UserManager);
+
+    //The feed only reports what changes from now on, the current revision is fetched once
+    SyncDocument &document = d->documents[documentID];
+    if(document.loaded || document.waitingForChanges) return;
+
+    document.waitingForChanges = true;
+    d->couchDB->retrieveDocument(d->database(), documentID);
+}
+
+void UserManager::listenToChanges()
+{
+    Q_D(UserManager);
+
+    if(d->changesReply || d->changesSequence.isEmpty() || !d->username.count()) return;
+
+    QUrl url(d->serverUrl + "/" + d->database() + "/_changes");
+    QUrlQuery query;
+    query.addQueryItem("feed", "longpoll");
+    query.addQueryItem("heartbeat", QString::number(CHANGES_HEARTBEAT));
+    query.addQueryItem("since", d->changesSequence);
+    url.setQuery(query);
+
+    QNetworkRequest request(url);
+    request.setRawHeader("Authorization", "Basic " + QString(d->username + ":" + d->password).toUtf8().toBase64());
+
+    d->changesReply = d->networkManager->get(request);
+    connect(d->changesReply, SIGNAL(finished()), SLOT(changesReceived()));
+}
+
+void UserManager::changesReceived()
+{
+    Q_D(UserManager);
+
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if(!reply || reply != d->changesReply) return;
+
+    d->changesReply = 0;
+    reply->deleteLater();
+
+    if(reply->error() != QNetworkReply::NoError)
+    {
+        qDebug() << "Failed to read the changes of" << d->database() << reply->errorString();
+        QTimer::singleShot(d->changesRetryDelay, this, SLOT(listenToChanges()));
+        d->changesRetryDelay = qMin(d->changesRetryDelay * 2, SYNC_RETRY_MAXIMUM);
+        return;
+    }
+    d->changesRetryDelay = SYNC_RETRY_DELAY;
+
+    QJsonObject obj = QJsonDocument::fromJson(reply->readAll()).object();
+    d->changesSequence = obj.value("last_seq").toVariant().toString();
+
+    QJsonArray resultsArray = obj.value("results").toArray();
+    for(int i = 0; i < resultsArray.count(); ++i)
+    {
+        QJsonObject resultObj = resultsArray.at(i).toObject();
+        QString documentID = resultObj.value("id").toString();
+        if(!d->documents.contains(documentID)) continue;
+
+        QJsonArray changesArray = resultObj.value("changes").toArray();
+        if(!changesArray.isEmpty()) changesMade(documentID, changesArray.first().toObject().value("rev").toString());
+    }
+
+    listenToChanges();
+}
+
 void UserManager::uploadDocument()
 {
     Q_D(UserManager);
 
-    if(d->waitingForChanges || !d->documentReadyForUpload) return;
+    foreach(QString documentID, d->documents.keys())
+    {
+        uploadDocument(documentID);
+    }
+}
+
+void UserManager::uploadDocument(const QString &documentID)
+{
+    Q_D(UserManager);
+
+    //Edits made before the account moved to one document per playlist wait for the migration
+    if(!d->sharded) return;
+
+    SyncDocument &document = d->documents[documentID];
+    if(document.uploading || document.waitingForChanges || !document.readyForUpload()) return;
+
+    //Written against the revision the operations were replayed on, a newer one on the server fails the update
+    QJsonObject obj = document.localContent();
+    if(!document.revision.isEmpty()) obj.insert("_rev", QJsonValue(document.revision));
+
+    const QByteArray data = QJsonDocument(obj).toJson(QJsonDocument::Compact);
+    d->couchDB->updateDocument(d->database(), documentID, data);
+
+    ++d->uploads;
+    ++d->uploadsInFlight;
+    d->uploadedBytes += data.size();
+
+    document.sentOperations = document.operations.count();
+    document.uploading = true;
+    document.waitingForChanges = true;
+}
+
+void UserManager::applyDocuments()
+{
+    Q_D(UserManager);
+
+    QJsonObject obj;
+
+    if(d->documents.value(FAVORITES_DOCUMENT).loaded) obj.insert("Favorites", d->documentItems(FAVORITES_DOCUMENT));
+
+    foreach(QString name, d->playlistDocuments.keys())
+    {
+        QString documentID = d->playlistDocuments.value(name);
+        if(d->documents.value(documentID).loaded) obj.insert(name, d->documentItems(documentID));
+    }
+
+    //Only the playlists and items that differ from the local state are touched
+    PlaylistsManager::singleton()->applyDocument(QJsonDocument(obj));
+}
+
+void UserManager::indexRetrieved(const QJsonObject &obj)
+{
+    Q_D(UserManager);
+
+    SyncDocument &indexDocument = d->documents[INDEX_DOCUMENT];
+    indexDocument.waitingForChanges = false;
+    indexDocument.loaded = true;
+    indexDocument.stored = true;
+    indexDocument.revision = obj.value("_rev").toString();
+    indexDocument.content = UserManagerPrivate::documentContent(obj);
+
+    //A name created here that the server already maps to another document is merged into that one instead of replacing it
+    if(!indexDocument.uploading)
+    {
+        QJsonObject playlistsObj = indexDocument.content.value("playlists").toObject();
+
+        QList<SyncOperation> operations;
+        foreach(SyncOperation operation, indexDocument.operations)
+        {
+            QString existingID = playlistsObj.value(operation.key).toString();
+            if(operation.type != SyncOperation::OPERATION_ADD_PLAYLIST || existingID.isEmpty() || existingID == operation.value.toString())
+            {
+                operations.append(operation);
+                continue;
+            }
+
+            qDebug() << "Merging playlist" << operation.key << "into" << existingID;
+            d->mergePlaylistDocument(operation.value.toString(), existingID);
+        }
+        d->documents[INDEX_DOCUMENT].operations = operations;
+        d->documents[INDEX_DOCUMENT].sentOperations = 0;
+    }
+
+    if(d->firstTime)
+    {
+        PlaylistsManager::singleton()->setDocument(QJsonDocument());
+        d->firstTime = false;
+    }
+
+    //Playlists created, renamed or deleted here are replayed on top of the ones from other devices
+    QHash<QString, QString> previousDocuments = d->playlistDocuments;
+    d->refreshPlaylistDocuments();
+
+    foreach(QString documentID, previousDocuments.values())
+    {
+        if(d->playlistDocuments.values().contains(documentID) || !d->documents.contains(documentID)) continue;
+        if(!d->documents.value(documentID).operations.isEmpty()) continue;
+
+        d->documents.remove(documentID);
+    }
+
+    listenToDocument(FAVORITES_DOCUMENT);
+    foreach(QString documentID, d->playlistDocuments.values())
+    {
+        listenToDocument(documentID);
+    }
+
+    //Merged operations and orphaned documents go out along with the index
+    uploadDocument();
+    applyDocuments();
+}
+
+void UserManager::legacyDocumentRetrieved(const QJsonObject &obj)
+{
+    Q_D(UserManager);
+
+    qDebug() << "Moving" << LEGACY_DOCUMENT << "into one document per playlist";
+
+    d->sharded = true;
+    d->localSettings.setValue(d->username + "-general/sharded_documents", true);
 
-    QJsonObject obj = d->documentToUpload.object();
-    obj.insert("_rev", QJsonValue(d->videosListener->revision()));
-    d->documentToUpload = QJsonDocument(obj);
-    d->couchDB->updateDocument(d->videosListener->database(), d->videosListener->documentID(), d->documentToUpload.toJson());
+    if(d->firstTime)
+    {
+        PlaylistsManager::singleton()->setDocument(QJsonDocument());
+        d->firstTime = false;
+    }
+
+    //The old document is left as it was, the new ones are all created from it, even when empty
+    d->documents[INDEX_DOCUMENT].loaded = true;
+    d->documents[FAVORITES_DOCUMENT].loaded = true;
+    stageDocuments(UserManagerPrivate::documentContent(obj));
 
-    d->waitingForChanges = true;
-    d->documentReadyForUpload = false;
+    applyDocuments();
 }
 
-void UserManager::changesMade(const QString &revision)
+void UserManager::changesMade(const QString &documentID, const QString &revision)
 {
     Q_D(UserManager);
 
-    CouchDBListener *listener = qobject_cast<CouchDBListener*>(sender());
+    SyncDocument &document = d->documents[documentID];
 
-    if(!listener) return;
+    //A revision written from here is already known, only the ones from other devices are fetched
+    if(revision == document.revision || document.ownRevisions.contains(revision))
+    {
+        document.ownRevisions.clear();
+        document.waitingForChanges = false;
+        ++d->avoidedRefetches;
 
-    d->waitingForChanges = true;
+        uploadDocument(documentID);
+        return;
+    }
 
-    qDebug() << "Changes were made to" << listener->database() << listener->documentID() << ". Revision:" << revision;
-    d->couchDB->retrieveDocument(listener->database(), listener->documentID());
+    //The update reply tells whether this one is ours
+    if(document.uploading)
+    {
+        document.announcedRevision = revision;
+        return;
+    }
+
+    document.ownRevisions.clear();
+    document.waitingForChanges = true;
+    ++d->refetches;
+
+    qDebug() << "Changes were made to" << d->database() << documentID << ". Revision:" << revision;
+    d->couchDB->retrieveDocument(d->database(), documentID);
 }
 
 void UserManager::documentRetrieved(const CouchDBResponse& response)
@@ -661,88 +1365,208 @@ void UserManager::documentRetrieved(const CouchDBResponse& response)
     if(response.status() != COUCHDB_SUCCESS)
     {
         qDebug() << "Failed to retrieve document" << response.database() << response.documentID();
-        d->couchDB->retrieveDocument(response.database(), response.documentID());
+
+        //Only an index confirmed missing means the account is still on the single videos document, any other failure is retried
+        if(!d->sharded && response.documentID() == INDEX_DOCUMENT)
+        {
+            if(UserManagerPrivate::documentMissing(response)) d->couchDB->retrieveDocument(response.database(), LEGACY_DOCUMENT);
+            else scheduleRetry(INDEX_DOCUMENT);
+        }
+        else if(!d->sharded && response.documentID() == LEGACY_DOCUMENT)
+        {
+            //A new account has neither, its library starts out empty
+            if(UserManagerPrivate::documentMissing(response))
+            {
+                legacyDocumentRetrieved(QJsonObject());
+                emit documentUpdated();
+            }
+            else scheduleRetry(LEGACY_DOCUMENT);
+        }
+        else if(UserManagerPrivate::documentMissing(response) && d->documents.contains(response.documentID()))
+        {
+            //Never written yet, whatever is known locally creates it without a revision
+            SyncDocument &document = d->documents[response.documentID()];
+            document.waitingForChanges = false;
+            document.loaded = true;
+            document.stored = false;
+            document.revision.clear();
+            document.content = QJsonObject();
+
+            uploadDocument(response.documentID());
+        }
+        else if(!UserManagerPrivate::documentMissing(response)) scheduleRetry(response.documentID());
         return;
     }
 
+    //A fetch following a failed update proves nothing about the update, the backoff stays until one goes through
+    if(!d->failedUpdates.contains(response.documentID())) d->retryDelay = SYNC_RETRY_DELAY;
+
     if(response.documentID() == "settings")
     {
         d->currentSettingsRevision = response.documentObj().value("_rev").toString();
         d->email = response.documentObj().value("email").toString();
+        return;
     }
-    else if(response.documentID() == "videos")
+
+    if(response.documentID() == INDEX_DOCUMENT)
     {
-        d->waitingForChanges = false;
+        if(!d->sharded)
+        {
+            d->sharded = true;
+            d->localSettings.setValue(d->username + "-general/sharded_documents", true);
+        }
 
-        d->videosDocument = response.document();
+        indexRetrieved(response.documentObj());
+        emit documentUpdated();
+    }
+    else if(response.documentID() == LEGACY_DOCUMENT)
+    {
+        if(d->sharded) return;
 
-        uploadDocument();
+        legacyDocumentRetrieved(response.documentObj());
+        emit documentUpdated();
+    }
+    else if(d->documents.contains(response.documentID()))
+    {
+        SyncDocument &document = d->documents[response.documentID()];
+        document.waitingForChanges = false;
+        document.loaded = true;
+        document.stored = true;
+        document.revision = response.documentObj().value("_rev").toString();
+        document.content = UserManagerPrivate::documentContent(response.documentObj());
+
+        //A deleted playlist is no longer followed once its removal came back
+        if(document.content.value("deleted").toBool() && document.operations.isEmpty() && !d->playlistDocuments.values().contains(response.documentID()))
+        {
+            d->documents.remove(response.documentID());
+            checkUploadsFinished();
+            return;
+        }
+
+        //Edits not acknowledged yet are replayed on the fresh revision
+        uploadDocument(response.documentID());
+        applyDocuments();
+
+        emit documentUpdated();
+    }
+
+    checkUploadsFinished();
+}
 
-        if(d->firstTime)
+void UserManager::documentUpdated(const CouchDBResponse& response)
+{
+    Q_D(UserManager);
+
+    if(d->uploadsInFlight > 0) --d->uploadsInFlight;
+
+    if(!d->documents.contains(response.documentID()))
+    {
+        checkUploadsFinished();
+        return;
+    }
+
+    SyncDocument &document = d->documents[response.documentID()];
+    document.uploading = false;
+
+    //The acknowledged operations are part of the server document now
+    if(response.status() == COUCHDB_SUCCESS)
+    {
+        while(document.sentOperations > 0 && !document.operations.isEmpty())
         {
-            ApplicationManager::singleton()->setNotificationsEnabled(false);
-            PlaylistsManager::singleton()->setDocument(d->videosDocument);
+            document.operations.takeFirst().apply(document.content);
+            --document.sentOperations;
+        }
+        document.sentOperations = 0;
+        document.stored = true;
 
-            foreach(QString entry, d->videosDocument.object().keys())
-            {
-                if(entry == "_id" || entry == "_rev") continue;
-
-                if(entry == "Favorites")
-                {
-                    QJsonObject favoritesObj = d->videosDocument.object().value(entry).toObject();
-
-                    foreach(QString key, favoritesObj.keys())
-                    {
-                        QJsonObject itemObj = favoritesObj.value(key).toObject();
-                        PlaylistsManager::singleton()->addFavorite(key, itemObj.value("title").toString(), itemObj.value("subtitle").toString(), itemObj.value("thumbnail").toString(),
-                                                                   itemObj.value("duration").toString(), itemObj.value("timestamp").toString());
-                    }
-                }
-                else
-                {
-                    Playlist *playlist;
-
-                    if(PlaylistsManager::singleton()->playlistNames().contains(entry))
-                    {
-                        playlist = PlaylistsManager::singleton()->playlist(entry);
-                    }
-                    else
-                    {
-                        playlist = new Playlist(this);
-                        playlist->setName(entry);
-                        PlaylistsManager::singleton()->addPlaylist(playlist);
-                    }
-
-                    QJsonObject playlistObj = d->videosDocument.object().value(entry).toObject();
-
-                    foreach(QString key, playlistObj.keys())
-                    {
-                        QJsonObject itemObj = playlistObj.value(key).toObject();
-                        playlist->addItem(key, itemObj.value("title").toString(), itemObj.value("subtitle").toString(), itemObj.value("thumbnail").toString(),
-                                          itemObj.value("duration").toString(), itemObj.value("timestamp").toString());
-                    }
-                }
-            }
-            ApplicationManager::singleton()->setNotificationsEnabled(true);
+        d->failedUpdates.remove(response.documentID());
+        if(d->failedUpdates.isEmpty()) d->retryDelay = SYNC_RETRY_DELAY;
 
-            d->firstTime = false;
+        //Without the new revision the document is fetched again once the change comes back
+        const QString revision = response.documentObj().value("rev").toString();
+        if(revision.isEmpty())
+        {
+            checkUploadsFinished();
+            return;
         }
 
-        emit documentUpdated();
+        const QString announcedRevision = document.announcedRevision;
+        document.announcedRevision.clear();
+        document.revision = revision;
+
+        if(!announcedRevision.isEmpty() && announcedRevision != revision)
+        {
+            ++d->refetches;
+            d->couchDB->retrieveDocument(d->database(), response.documentID());
+            checkUploadsFinished();
+            return;
+        }
+
+        if(announcedRevision == revision) ++d->avoidedRefetches;
+        else document.ownRevisions.insert(revision);
+
+        //The written revision is current, edits made meanwhile go out without waiting for the change feed
+        document.waitingForChanges = false;
+        uploadDocument(response.documentID());
+        checkUploadsFinished();
+        return;
     }
+
+    document.sentOperations = 0;
+    document.announcedRevision.clear();
+
+    if(d->connectionIsDown)
+    {
+        qDebug() << "Failed to update document" << response.documentID() << "while offline";
+        document.waitingForChanges = false;
+        return;
+    }
+
+    //A conflict is rebased right away, one fetch of the current revision and the pending operations go out again on top of it
+    if(UserManagerPrivate::documentConflict(response))
+    {
+        qDebug() << "Conflict updating document" << response.documentID() << ", replaying its edits on the current revision";
+        d->couchDB->retrieveDocument(d->database(), response.documentID());
+        return;
+    }
+
+    //Anything else would fail the same way again, it is retried with the backoff
+    qDebug() << "Failed to update document" << response.documentID() << response.documentObj().value("error").toString();
+    d->failedUpdates.insert(response.documentID());
+    scheduleRetry(response.documentID());
 }
 
-void UserManager::documentUpdated(const CouchDBResponse& response)
+void UserManager::scheduleRetry(const QString &documentID)
+{
+    Q_D(UserManager);
+
+    //Failures back off up to a minute, the server or the connection is given time to come back
+    d->retryDocuments.insert(documentID);
+    if(d->retryTimer->isActive()) return;
+
+    d->retryTimer->start(d->retryDelay);
+    d->retryDelay = qMin(d->retryDelay * 2, SYNC_RETRY_MAXIMUM);
+}
+
+void UserManager::retryDocuments()
 {
     Q_D(UserManager);
 
-    if(response.documentID() != d->videosListener->documentID()) return;
+    QSet<QString> documentIDs = d->retryDocuments;
+    d->retryDocuments.clear();
 
-    if(response.status() == COUCHDB_SUCCESS) return;
+    foreach(QString documentID, documentIDs)
+    {
+        d->couchDB->retrieveDocument(d->database(), documentID);
+    }
+}
+
+void UserManager::checkUploadsFinished()
+{
+    Q_D(UserManager);
 
-    qDebug() << "Failed to update document...";
-    d->waitingForChanges = false;
-    d->documentReadyForUpload = true;
+    //Follow-up uploads and conflict replays are issued before this, closing waits for all of them
+    if(d->synced()) emit uploadsFinished();
 }
 
 void UserManager::networkStatusChanged(QNetworkAccessManager::NetworkAccessibility accessibility)
@@ -760,7 +1584,7 @@ void UserManager::networkStatusChanged(QNetworkAccessManager::NetworkAccessibili
         qDebug() << "Connection is up! :)";
         d->connectionIsDown = false;
         connectionIsDownChanged(d->connectionIsDown);
-        if(d->documentReadyForUpload)
+        if(d->uploadPending())
         {
             QTimer::singleShot(2000, this, SLOT(uploadDocument()));
         }
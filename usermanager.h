@@ -3,6 +3,8 @@
 
 #include <QObject>
 #include <QNetworkAccessManager>
+#include <QJsonObject>
+#include <QVariantMap>
 
 #include <couchdbresponse.h>
 
@@ -46,6 +48,8 @@ public:
     bool musicOnlyFilter() const;
     void setMusicOnlyFilter(const bool& musicOnly);
 
+    Q_INVOKABLE QVariantMap syncStatistics() const;
+
 signals:
     void connectionIsDownChanged(const bool& connectionIsDown);
 
@@ -74,6 +78,7 @@ signals:
     void loginFailed(const QString& message);
 
     void documentUpdated();
+    void uploadsFinished();
 
     void queueItemAdded(QObject *item);
 
@@ -98,7 +103,12 @@ public slots:
     void startListeningToChanges();
     bool stopListeningToChanges();
 
-    void updateDocument(const QJsonDocument& document);
+    void recordPlaylistAdded(const QString& name);
+    void recordPlaylistRenamed(const QString& oldName, const QString& name);
+    void recordPlaylistRemoved(const QString& name);
+    void recordItemAdded(const QString& playlistName, const QString& id, const QJsonValue& item);
+    void recordItemRemoved(const QString& playlistName, const QString& id);
+    bool flushDocuments();
 
 private slots:
     void createAccountVerificationReply();
@@ -108,18 +118,33 @@ private slots:
     void changePasswordReply();
 
     void loginReply(const CouchDBResponse &response);
+    void finishLogout();
 
     void uploadDocument();
-    void changesMade(const QString &revision);
+    void retryDocuments();
+    void listenToChanges();
+    void changesReceived();
     void documentRetrieved(const CouchDBResponse& response);
     void documentUpdated(const CouchDBResponse& response);
 
     void networkStatusChanged(QNetworkAccessManager::NetworkAccessibility accessibility);
+    void videoDurationResolved(const QString& id, const QString& duration);
 
 private:
     explicit UserManager(QObject *parent = 0);
     virtual ~UserManager();
 
+    void listenToDocument(const QString& documentID);
+    void changesMade(const QString& documentID, const QString& revision);
+    void mutationRecorded();
+    void stageDocuments(const QJsonObject& obj);
+    void uploadDocument(const QString& documentID);
+    void applyDocuments();
+    void indexRetrieved(const QJsonObject& obj);
+    void legacyDocumentRetrieved(const QJsonObject& obj);
+    void checkUploadsFinished();
+    void scheduleRetry(const QString& documentID);
+
     static UserManager *_singleton;
 
     Q_DECLARE_PRIVATE(UserManager)
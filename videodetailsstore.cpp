@@ -0,0 +1,183 @@
+#include "videodetailsstore.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSettings>
+#include <QTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtAlgorithms>
+
+#define MAXIMUM_ENTRIES 20000
+#define SAVE_DELAY 5000
+
+VideoDetailsStore *VideoDetailsStore::_singleton = 0;
+
+class VideoDetailsStorePrivate
+{
+public:
+    VideoDetailsStorePrivate() :
+        saveTimer(0)
+    {
+        QSettings localSettings(QSettings::IniFormat, QSettings::UserScope, "BeatWhale", "beatwhale_app");
+        QString path = QFileInfo(localSettings.fileName()).path() + "/cache";
+        QDir().mkpath(path);
+        filePath = path + "/videos.json";
+    }
+
+    virtual ~VideoDetailsStorePrivate()
+    {
+    }
+
+    void load()
+    {
+        QFile file(filePath);
+        if(!file.open(QFile::ReadOnly)) return;
+
+        QJsonObject storeObj = QJsonDocument::fromJson(file.readAll()).object();
+        foreach(QString id, storeObj.keys())
+        {
+            QJsonObject detailsObj = storeObj.value(id).toObject();
+
+            VideoDetails details;
+            details.id = id;
+            details.title = detailsObj.value("title").toString();
+            details.thumbnail = detailsObj.value("thumbnail").toString();
+            details.duration = detailsObj.value("duration").toString();
+            videos.insert(id, details);
+            timestamps.insert(id, detailsObj.value("timestamp").toVariant().toLongLong());
+        }
+    }
+
+    void prune()
+    {
+        if(videos.count() <= MAXIMUM_ENTRIES) return;
+
+        //Drop the oldest tenth so pruning does not run on every insert
+        QList<qint64> sortedTimestamps = timestamps.values();
+        qSort(sortedTimestamps);
+        qint64 threshold = sortedTimestamps.at(sortedTimestamps.count() / 10);
+
+        foreach(QString id, timestamps.keys())
+        {
+            if(timestamps.value(id) > threshold) continue;
+            videos.remove(id);
+            timestamps.remove(id);
+        }
+    }
+
+    QString filePath;
+    QTimer *saveTimer;
+
+    QHash<QString, VideoDetails> videos;
+    QHash<QString, qint64> timestamps;
+};
+
+VideoDetailsStore::VideoDetailsStore(QObject *parent) :
+    QObject(parent),
+    d_ptr(new VideoDetailsStorePrivate)
+{
+    Q_D(VideoDetailsStore);
+
+    d->saveTimer = new QTimer(this);
+    d->saveTimer->setSingleShot(true);
+    d->saveTimer->setInterval(SAVE_DELAY);
+    connect(d->saveTimer, SIGNAL(timeout()), SLOT(save()));
+
+    if(QCoreApplication::instance()) connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), SLOT(save()));
+
+    d->load();
+}
+
+VideoDetailsStore::~VideoDetailsStore()
+{
+    save();
+    delete d_ptr;
+}
+
+VideoDetailsStore *VideoDetailsStore::singleton()
+{
+    if(!_singleton)
+    {
+        _singleton = new VideoDetailsStore;
+    }
+    return _singleton;
+}
+
+bool VideoDetailsStore::contains(const QString &id) const
+{
+    Q_D(const VideoDetailsStore);
+    return !d->videos.value(id).duration.isEmpty();
+}
+
+VideoDetails VideoDetailsStore::details(const QString &id) const
+{
+    Q_D(const VideoDetailsStore);
+    return d->videos.value(id);
+}
+
+QString VideoDetailsStore::duration(const QString &id) const
+{
+    Q_D(const VideoDetailsStore);
+    return d->videos.value(id).duration;
+}
+
+QStringList VideoDetailsStore::missingDurations(const QStringList &ids) const
+{
+    Q_D(const VideoDetailsStore);
+
+    QStringList missing;
+    foreach(QString id, ids)
+    {
+        if(d->videos.value(id).duration.isEmpty() && !missing.contains(id)) missing.append(id);
+    }
+    return missing;
+}
+
+void VideoDetailsStore::insert(const QString &id, const QString &title, const QString &thumbnail, const QString &duration)
+{
+    Q_D(VideoDetailsStore);
+
+    if(id.isEmpty()) return;
+
+    VideoDetails details = d->videos.value(id);
+    details.id = id;
+    if(!title.isEmpty()) details.title = title;
+    if(!thumbnail.isEmpty()) details.thumbnail = thumbnail;
+    if(!duration.isEmpty()) details.duration = duration;
+
+    d->videos.insert(id, details);
+    d->timestamps.insert(id, QDateTime::currentMSecsSinceEpoch());
+
+    if(!d->saveTimer->isActive()) d->saveTimer->start();
+}
+
+void VideoDetailsStore::save()
+{
+    Q_D(VideoDetailsStore);
+
+    d->saveTimer->stop();
+    d->prune();
+
+    QJsonObject storeObj;
+    foreach(VideoDetails details, d->videos.values())
+    {
+        if(details.duration.isEmpty()) continue;
+
+        QJsonObject detailsObj;
+        detailsObj.insert("title", details.title);
+        detailsObj.insert("thumbnail", details.thumbnail);
+        detailsObj.insert("duration", details.duration);
+        detailsObj.insert("timestamp", QString::number(d->timestamps.value(details.id)));
+        storeObj.insert(details.id, detailsObj);
+    }
+
+    QSaveFile file(d->filePath);
+    if(!file.open(QFile::WriteOnly)) return;
+    file.write(QJsonDocument(storeObj).toJson(QJsonDocument::Compact));
+    file.commit();
+}
@@ -0,0 +1,44 @@
+#ifndef VIDEODETAILSSTORE_H
+#define VIDEODETAILSSTORE_H
+
+#include <QObject>
+#include <QStringList>
+
+struct VideoDetails
+{
+    QString id;
+    QString title;
+    QString thumbnail;
+    QString duration;
+};
+
+class VideoDetailsStorePrivate;
+class VideoDetailsStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    static VideoDetailsStore* singleton();
+
+    bool contains(const QString& id) const;
+    VideoDetails details(const QString& id) const;
+    QString duration(const QString& id) const;
+    QStringList missingDurations(const QStringList& ids) const;
+
+    void insert(const QString& id, const QString& title, const QString& thumbnail, const QString& duration);
+
+public slots:
+    void save();
+
+private:
+    explicit VideoDetailsStore(QObject *parent = 0);
+    virtual ~VideoDetailsStore();
+
+    static VideoDetailsStore *_singleton;
+
+    Q_DECLARE_PRIVATE(VideoDetailsStore)
+    VideoDetailsStorePrivate * const d_ptr;
+
+};
+
+#endif // VIDEODETAILSSTORE_H
@@ -1,26 +1,292 @@
 #include "youtubeapimanager.h"
-
-#include <jsonhelper.h>
+#include "searchcache.h"
+#include "videodetailsstore.h"
+#include "deadlinescheduler.h"
+#include "apiratelimiter.h"
+#include "youtubedlpool.h"
+#include "streambuffer.h"
+#include "mediacache.h"
 
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
+#include <QPointer>
+#include <QCache>
+#include <QDate>
+#include <QDateTime>
 #include <QtQml>
 #include <QDebug>
 #include <QProcess>
-
-#define TIMEOUT_INTERVAL 20000
+#include <QSettings>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QRegularExpression>
+#include <QTimer>
+
+#define SEARCH_FIELDS "nextPageToken,items(id/videoId,snippet/title,snippet/thumbnails/high/url)"
+#define VIDEOS_FIELDS "items(id,contentDetails/duration)"
+#define SUGGESTION_POOL_TTL 7200000
+#define SUGGESTION_POOL_LOW 5
+#define SUGGESTION_POOLS_MAXIMUM 20
+#define HISTORY_MAXIMUM 5000
+#define STREAM_URLS_MAXIMUM 200
+#define STREAM_URL_DEFAULT_TTL 1800
+#define DURATION_BATCH_SIZE 50
+#define DURATION_BATCH_DELAY 50
+#define YOUTUBEDL_UPDATE_DEADLINE 120000
 
 YoutubeAPIManager *YoutubeAPIManager::_singleton = 0;
 
+static QNetworkRequest apiRequest(const QUrl& url)
+{
+    QNetworkRequest request(url);
+
+    //Google only compresses responses for clients that mention gzip in the user agent,
+    //Qt adds the Accept-Encoding header and inflates the reply itself
+    request.setHeader(QNetworkRequest::UserAgentHeader, "BeatWhale (gzip)");
+    return request;
+}
+
+static QString formatDuration(QString videoDuration)
+{
+    if(!videoDuration.startsWith("PT")) return QString();
+
+    videoDuration = videoDuration.remove(0, 2);
+    QString hoursStr, minutesStr, secondsStr;
+
+    //Hours
+    if(videoDuration.contains("H"))
+    {
+        hoursStr = videoDuration.left(videoDuration.indexOf("H"));
+        if(hoursStr.count() < 2) hoursStr.insert(0, "0");
+        videoDuration = videoDuration.remove(0, videoDuration.indexOf("H") + 1);
+    }
+
+    //Minutes
+    {
+        if(videoDuration.contains("M")) {
+            minutesStr = videoDuration.left(videoDuration.indexOf("M"));
+        }
+        while (minutesStr.count() < 2) minutesStr.insert(0, "0");
+        videoDuration = videoDuration.remove(0, videoDuration.indexOf("M") + 1);
+    }
+
+    //Seconds
+    {
+        secondsStr = videoDuration.left(videoDuration.indexOf("S"));
+        while (secondsStr.count() < 2) secondsStr.insert(0, "0");
+    }
+
+    QString duration;
+    if(hoursStr.count()) duration.append(hoursStr + ":");
+    if(minutesStr.count()) duration.append(minutesStr + ":");
+    duration.append(secondsStr);
+
+    return duration;
+}
+
+static QString youtubeDLFileName(const QString& name)
+{
+#ifdef Q_OS_WIN
+    return name + ".exe";
+#else
+    return name;
+#endif
+}
+
+static QString formatSeconds(int seconds)
+{
+    if(seconds <= 0) return QString();
+
+    QString duration;
+    if(seconds >= 3600) duration.append(QString::number(seconds / 3600).rightJustified(2, '0') + ":");
+    duration.append(QString::number(seconds / 60 % 60).rightJustified(2, '0') + ":");
+    duration.append(QString::number(seconds % 60).rightJustified(2, '0'));
+
+    return duration;
+}
+
+static QJsonDocument pageDocument(const QList<SearchResult>& results, const QString& nextPageToken)
+{
+    QJsonArray items;
+    foreach(SearchResult result, results)
+    {
+        QJsonObject itemObj;
+        itemObj.insert("id", result.id);
+        itemObj.insert("title", result.title);
+        itemObj.insert("subtitle", result.subTitle);
+        itemObj.insert("thumbnail", result.thumbnail);
+        itemObj.insert("duration", result.duration);
+        items.append(itemObj);
+    }
+
+    QJsonObject pageObj;
+    pageObj.insert("items", items);
+    if(!nextPageToken.isEmpty()) pageObj.insert("nextPageToken", nextPageToken);
+    return QJsonDocument(pageObj);
+}
+
+static QList<SearchResult> pageResults(const QJsonDocument& document)
+{
+    QList<SearchResult> results;
+
+    QJsonArray items = document.object().value("items").toArray();
+    for(int i = 0; i < items.count(); ++i)
+    {
+        QJsonObject itemObj = items.at(i).toObject();
+
+        SearchResult result;
+        result.id = itemObj.value("id").toString();
+        if(itemObj.contains("subtitle"))
+        {
+            result.title = itemObj.value("title").toString();
+            result.subTitle = itemObj.value("subtitle").toString();
+        }
+        else
+        {
+            SearchResultsModel::splitTitle(itemObj.value("title").toString(), &result.title, &result.subTitle);
+        }
+        result.thumbnail = itemObj.value("thumbnail").toString();
+        result.duration = itemObj.value("duration").toString();
+        results.append(result);
+    }
+
+    return results;
+}
+
+struct SearchRequest
+{
+    SearchRequest() : id(0), onlyMusic(false), page(0), fromCache(false), prefetch(false) {}
+
+    int id;
+    QPointer<SearchResultsModel> model;
+    QPointer<SearchResultsModel> origin;
+    QPointer<QNetworkReply> reply;
+    QString query;
+    QString pageToken;
+    QString orderBy;
+    QString duration;
+    bool onlyMusic;
+    int page;
+    QList<SearchResult> results;
+    QString nextPageToken;
+    QString cacheKey;
+    bool fromCache;
+    bool prefetch;
+};
+
+struct SuggestionPool
+{
+    SuggestionPool() : created(0), refilling(false) {}
+
+    QList<VideoDetails> candidates;
+    QString nextPageToken;
+    qint64 created;
+    bool refilling;
+};
+
+struct StreamUrl
+{
+    StreamUrl() : expires(0) {}
+
+    QString url;
+    qint64 expires;
+    QVariantList formats;
+};
+
+//googlevideo URLs carry their expiry as an expire= parameter, or an /expire/ segment for manifests
+static qint64 streamUrlExpiry(const QString& url)
+{
+    qint64 expiry = 0;
+
+    QRegularExpressionMatchIterator it = QRegularExpression("expire[=/](\\d+)").globalMatch(url);
+    while(it.hasNext())
+    {
+        qint64 value = it.next().captured(1).toLongLong() * 1000;
+        if(!expiry || value < expiry) expiry = value;
+    }
+
+    return expiry;
+}
+
+struct VideoInfo
+{
+    QString id;
+    QString url;
+    QString title;
+    QString thumbnail;
+    QString duration;
+    QVariantList formats;
+};
+
+//One youtube-dl -j run describes the whole video, stream URL included
+static VideoInfo parseVideoInfo(const QByteArray& output)
+{
+    VideoInfo info;
+
+    QJsonObject infoObj = QJsonDocument::fromJson(output.trimmed()).object();
+    if(infoObj.isEmpty()) return info;
+
+    info.id = infoObj.value("id").toString();
+    info.title = infoObj.value("title").toString();
+    info.thumbnail = infoObj.value("thumbnail").toString();
+    info.duration = formatSeconds(infoObj.value("duration").toDouble());
+    info.url = infoObj.value("url").toString();
+
+    //Merged formats have no url of their own, only a requested format carrying both audio and video plays with sound
+    if(info.url.isEmpty())
+    {
+        QJsonArray requestedFormats = infoObj.value("requested_formats").toArray();
+        for(int i = 0; i < requestedFormats.count() && info.url.isEmpty(); ++i)
+        {
+            QJsonObject formatObj = requestedFormats.at(i).toObject();
+            if(formatObj.value("acodec").toString() == "none" || formatObj.value("vcodec").toString() == "none") continue;
+            info.url = formatObj.value("url").toString();
+        }
+    }
+
+    QJsonArray formats = infoObj.value("formats").toArray();
+    for(int i = 0; i < formats.count(); ++i)
+    {
+        QJsonObject formatObj = formats.at(i).toObject();
+
+        QVariantMap format;
+        format.insert("id", formatObj.value("format_id").toString());
+        format.insert("extension", formatObj.value("ext").toString());
+        format.insert("audioCodec", formatObj.value("acodec").toString());
+        format.insert("videoCodec", formatObj.value("vcodec").toString());
+        format.insert("bitrate", formatObj.value("tbr").toDouble());
+        format.insert("url", formatObj.value("url").toString());
+        info.formats.append(format);
+    }
+
+    return info;
+}
+
 class YoutubeAPIManagerPrivate
 {
 public:
     YoutubeAPIManagerPrivate() :
         networkManager(0),
         youtubeUpdateProcess(0),
-        youtubeUrlProcess(0),
-        youtubeDurationProcess(0),
+        youtubeVerifyProcess(0),
+        urlPool(0),
+        videoUrlRequestID(0),
+        videoUrlToken(0),
+        videoUrlWithVideo(false),
+        audioOnly(false),
+        crossfadeDuration(3000),
+        videoUrlDebounceTimer(0),
+        lastVideoUrlRequest(0),
+        streamUrlMargin(300),
+        durationBatchTimer(0),
+        durationBatchesIDs(0),
+        searchCache(0),
         onlyMusic(false),
+        lastSearchRequestID(0),
+        prefetchEnabled(true),
+        prefetchMaximumPages(6),
+        prefetchQuota(5000),
+        prefetchQuotaUsed(0),
         orderFilter(YoutubeAPIManager::ORDER_VIEWCOUNT),
         durationFilter(YoutubeAPIManager::DURATION_ANY)
     {
@@ -30,29 +296,167 @@ public:
     {
         if(networkManager) delete networkManager;
 
-        foreach(QTimer *timer, repliesTimeoutMap.keys())
+        qDeleteAll(searchRequests);
+
+        if(urlPool) delete urlPool;
+    }
+
+    void loadHistory()
+    {
+        QFile file(historyFilePath);
+        if(!file.open(QFile::ReadOnly)) return;
+
+        QTextStream stream(&file);
+        while(!stream.atEnd())
+        {
+            QString id = stream.readLine().trimmed();
+            if(id.isEmpty() || playedIDs.contains(id)) continue;
+
+            playedIDs.insert(id);
+            playedHistory.append(id);
+        }
+        file.close();
+
+        if(playedHistory.count() <= HISTORY_MAXIMUM) return;
+
+        //Keep the most recent part and rewrite the file so it does not grow forever
+        while(playedHistory.count() > HISTORY_MAXIMUM) playedIDs.remove(playedHistory.takeFirst());
+
+        QSaveFile saveFile(historyFilePath);
+        if(!saveFile.open(QFile::WriteOnly)) return;
+        saveFile.write(playedHistory.join("\n").append("\n").toUtf8());
+        saveFile.commit();
+    }
+
+    void appendHistory(const QString& id)
+    {
+        if(id.isEmpty() || playedIDs.contains(id)) return;
+
+        playedIDs.insert(id);
+        playedHistory.append(id);
+
+        QFile file(historyFilePath);
+        if(!file.open(QFile::WriteOnly | QFile::Append)) return;
+        file.write(QString(id + "\n").toUtf8());
+    }
+
+    bool excluded(const QString& id) const
+    {
+        return queuedIDs.contains(id) || playedIDs.contains(id);
+    }
+
+    QString streamUrl(const QString& id)
+    {
+        if(!streamUrls.contains(id)) return QString();
+
+        //Expiring links are resolved again, playback could outlast them otherwise
+        if(QDateTime::currentMSecsSinceEpoch() + qint64(streamUrlMargin) * 1000 >= streamUrls.value(id).expires)
         {
-            delete timer;
+            streamUrls.remove(id);
+            return QString();
         }
 
-        if(youtubeUrlProcess) delete youtubeUrlProcess;
-        if(youtubeDurationProcess) delete youtubeDurationProcess;
+        return streamUrls.value(id).url;
+    }
+
+    void insertStreamUrl(const QString& id, const QString& url, const QVariantList& formats = QVariantList())
+    {
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+        StreamUrl streamUrl;
+        streamUrl.url = url;
+        streamUrl.formats = formats;
+        streamUrl.expires = streamUrlExpiry(url);
+        if(!streamUrl.expires) streamUrl.expires = now + STREAM_URL_DEFAULT_TTL * 1000;
+
+        if(streamUrls.count() >= STREAM_URLS_MAXIMUM)
+        {
+            QString oldestID;
+            foreach(QString urlID, streamUrls.keys())
+            {
+                if(streamUrls.value(urlID).expires <= now) streamUrls.remove(urlID);
+                else if(oldestID.isEmpty() || streamUrls.value(urlID).expires < streamUrls.value(oldestID).expires) oldestID = urlID;
+            }
+            if(streamUrls.count() >= STREAM_URLS_MAXIMUM) streamUrls.remove(oldestID);
+        }
+
+        streamUrls.insert(id, streamUrl);
+    }
+
+    //Audio only playback leaves the video track out entirely, the muxed stream is the fallback
+    QString playbackStreamUrl(const QString& id, const bool& withVideo)
+    {
+        QString url = streamUrl(id);
+        if(url.isEmpty() || withVideo || !audioOnly) return url;
+
+        QString audioUrl = MediaCache::audioFormat(streamUrls.value(id).formats).value("url").toString();
+        return audioUrl.isEmpty() ? url : audioUrl;
+    }
+
+    void cacheMedia(const QString& id)
+    {
+        if(!streamUrls.contains(id) || !MediaCache::singleton()->wants(id)) return;
+
+        QVariantMap format = MediaCache::audioFormat(streamUrls.value(id).formats);
+        if(format.isEmpty()) return;
+
+        MediaCache::singleton()->store(id, format.value("id").toString(), format.value("extension").toString(), format.value("url").toString());
     }
 
     QString youtubeAPIKey;
 
     QNetworkAccessManager *networkManager;
 
-    QMap<QTimer*, QNetworkReply*> repliesTimeoutMap;
-
     QProcess *youtubeUpdateProcess;
-    QProcess *youtubeUrlProcess;
-    QProcess *youtubeDurationProcess;
+    QProcess *youtubeVerifyProcess;
+    QString youtubeDLProgramPath;
+    QString youtubeDLUpdatesPath;
+    YoutubeDLPool *urlPool;
+    int videoUrlRequestID;
+    int videoUrlToken;
+    bool videoUrlWithVideo;
+    bool audioOnly;
+    int crossfadeDuration;
+    QTimer *videoUrlDebounceTimer;
+    QString debouncedVideoID;
+    qint64 lastVideoUrlRequest;
+    QHash<int, QString> urlRequests;
+    QHash<QString, int> urlRequestIDs;
+    QSet<int> preresolveRequests;
+    QHash<QString, StreamUrl> streamUrls;
+    int streamUrlMargin;
+    QTimer *durationBatchTimer;
+    QStringList pendingDurationIDs;
+    int durationBatchesIDs;
+    QHash<int, QString> durationRequests;
+    QHash<QString, int> durationRequestIDs;
+    QSet<QString> durationIDs;
+
+    SearchCache *searchCache;
 
     bool onlyMusic;
-    QJsonDocument searchDocument;
-    QStringList excludeSuggestionIDs;
-    QStringList videoDurationRequests;
+    QHash<int, SearchRequest*> searchRequests;
+    int lastSearchRequestID;
+    QHash<QString, int> searchPages;
+
+    QHash<QString, qint64> transferredBytes;
+    QHash<QString, qint64> payloadBytes;
+    QHash<QString, qint64> measuredPayloadBytes;
+    QHash<QString, int> unmeasuredTransfers;
+    QHash<QString, int> transferCount;
+
+    bool prefetchEnabled;
+    int prefetchMaximumPages;
+    int prefetchQuota;
+    int prefetchQuotaUsed;
+    QDate prefetchQuotaDate;
+    QCache<QString, QJsonDocument> prefetchedPages;
+    QHash<QString, int> queuedIDs;
+    QSet<QString> playedIDs;
+    QStringList playedHistory;
+    QString historyFilePath;
+    QHash<QString, SuggestionPool> suggestionPools;
+    QString pendingSuggestionSeed;
 
     YoutubeAPIManager::OrderFilter orderFilter;
     YoutubeAPIManager::DurationFilter durationFilter;
@@ -66,24 +470,74 @@ YoutubeAPIManager::YoutubeAPIManager(QObject *parent) :
 
     d->networkManager = new QNetworkAccessManager(this);
     d->youtubeUpdateProcess = new QProcess(this);
-    d->youtubeUrlProcess = new QProcess(this);
-    d->youtubeDurationProcess = new QProcess(this);
+    d->youtubeVerifyProcess = new QProcess(this);
 
-    QString youtubeDLProgramPath;
+    QSettings localSettings(QSettings::IniFormat, QSettings::UserScope, "BeatWhale", "beatwhale_app");
+    QSettings settings("beatwhale_config.ini", QSettings::IniFormat);
+    d->searchCache = new SearchCache(QFileInfo(localSettings.fileName()).path() + "/cache/search", this);
+    d->searchCache->setTimeToLive(settings.value("search_cache_ttl", d->searchCache->timeToLive()).toInt());
+    d->searchCache->setMaximumSize(settings.value("search_cache_size", d->searchCache->maximumSize()).toLongLong());
+
+    d->prefetchEnabled = settings.value("prefetch_enabled", d->prefetchEnabled).toBool();
+    d->prefetchMaximumPages = settings.value("prefetch_max_pages", d->prefetchMaximumPages).toInt();
+    d->prefetchQuota = settings.value("prefetch_quota", d->prefetchQuota).toInt();
+    d->prefetchedPages.setMaxCost(settings.value("prefetch_max_results", 200).toInt());
+
+    QDir().mkpath(QFileInfo(localSettings.fileName()).path() + "/cache");
+    d->historyFilePath = QFileInfo(localSettings.fileName()).path() + "/cache/history.txt";
+    d->loadHistory();
+
+    QString youtubeDLProgramPath = QString(QCoreApplication::applicationDirPath() + "/" + youtubeDLFileName("youtube-dl"));
+
+    //Updates are verified in the local directory, the bundled binary stays as it was shipped
+    d->youtubeDLUpdatesPath = QFileInfo(localSettings.fileName()).path() + "/youtube-dl";
+    QDir().mkpath(d->youtubeDLUpdatesPath);
+
+    QString updatedProgramPath = localSettings.value("youtubedl_program").toString();
+    if(!updatedProgramPath.isEmpty() && QFile::exists(updatedProgramPath) &&
+            (!QFile::exists(youtubeDLProgramPath) || QFileInfo(updatedProgramPath).lastModified() >= QFileInfo(youtubeDLProgramPath).lastModified()))
+    {
+        youtubeDLProgramPath = updatedProgramPath;
+    }
 
-#ifdef Q_OS_UNIX
-    youtubeDLProgramPath = QString(QCoreApplication::applicationDirPath() + "/" + "youtube-dl");
-#else
-    youtubeDLProgramPath = QString(QCoreApplication::applicationDirPath() + "/" + "youtube-dl.exe");
-#endif
     if(!QFile::exists(youtubeDLProgramPath))
     {
         qDebug() << "Program Youtube-DL could not be found at" << youtubeDLProgramPath;
         exit(0);
     }
-    d->youtubeUpdateProcess->setProgram(youtubeDLProgramPath);
-    d->youtubeUrlProcess->setProgram(youtubeDLProgramPath);
-    d->youtubeDurationProcess->setProgram(youtubeDLProgramPath);
+    d->youtubeDLProgramPath = youtubeDLProgramPath;
+
+    //Nothing runs the previous updates or an interrupted staging anymore
+    foreach(QFileInfo fileInfo, QDir(d->youtubeDLUpdatesPath).entryInfoList(QDir::Files))
+    {
+        if(fileInfo.absoluteFilePath() != QFileInfo(youtubeDLProgramPath).absoluteFilePath()) QFile::remove(fileInfo.absoluteFilePath());
+    }
+
+    connect(d->youtubeUpdateProcess, SIGNAL(finished(int)), SLOT(youtubeDLUpdateFinished()));
+    connect(d->youtubeUpdateProcess, SIGNAL(error(QProcess::ProcessError)), SLOT(youtubeDLUpdateError(QProcess::ProcessError)));
+    connect(d->youtubeVerifyProcess, SIGNAL(finished(int)), SLOT(youtubeDLVerifyFinished()));
+    connect(d->youtubeVerifyProcess, SIGNAL(error(QProcess::ProcessError)), SLOT(youtubeDLUpdateError(QProcess::ProcessError)));
+
+    //A single JSON extraction gives the stream URL, duration and title at once
+    d->urlPool = new YoutubeDLPool(youtubeDLProgramPath, QStringList() << "-j" << "-f" << "best", this);
+    d->urlPool->setMaximumSize(settings.value("youtubedl_workers_max", d->urlPool->maximumSize()).toInt());
+    d->urlPool->setMinimumSize(settings.value("youtubedl_workers_min", d->urlPool->minimumSize()).toInt());
+    d->streamUrlMargin = settings.value("stream_url_margin", d->streamUrlMargin).toInt();
+    d->audioOnly = localSettings.value("audio_only", settings.value("audio_only", d->audioOnly)).toBool();
+    d->crossfadeDuration = localSettings.value("crossfade_duration", settings.value("crossfade_duration", d->crossfadeDuration)).toInt();
+    connect(d->urlPool, SIGNAL(resolved(int,QString,QByteArray,int)), SLOT(videoInfoFinished(int,QString,QByteArray,int)));
+    connect(d->urlPool, SIGNAL(failed(int,QString,QString)), SLOT(videoInfoError(int,QString,QString)));
+
+    //Requests closer together than this are a skip storm, only the last one is resolved
+    d->videoUrlDebounceTimer = new QTimer(this);
+    d->videoUrlDebounceTimer->setSingleShot(true);
+    d->videoUrlDebounceTimer->setInterval(settings.value("video_url_debounce", 250).toInt());
+    connect(d->videoUrlDebounceTimer, SIGNAL(timeout()), SLOT(videoUrlDebounced()));
+
+    d->durationBatchTimer = new QTimer(this);
+    d->durationBatchTimer->setSingleShot(true);
+    d->durationBatchTimer->setInterval(DURATION_BATCH_DELAY);
+    connect(d->durationBatchTimer, SIGNAL(timeout()), SLOT(videoDurationBatch()));
 
     QObject::connect(d->networkManager,SIGNAL(sslErrors(QNetworkReply*,QList<QSslError>)),SLOT(ignoreSSLErrors(QNetworkReply*,QList<QSslError>)));
 }
@@ -107,6 +561,18 @@ void YoutubeAPIManager::declareQML()
     qmlRegisterSingletonType<YoutubeAPIManager>("BeatWhaleAPI", 1, 0, "YoutubeAPI", qmlYoutubeAPIManagerSingleton);
 }
 
+SearchCache *YoutubeAPIManager::searchCache() const
+{
+    Q_D(const YoutubeAPIManager);
+    return d->searchCache;
+}
+
+YoutubeDLPool *YoutubeAPIManager::urlPool() const
+{
+    Q_D(const YoutubeAPIManager);
+    return d->urlPool;
+}
+
 void YoutubeAPIManager::setAPIKey(const QString &key)
 {
     Q_D(YoutubeAPIManager);
@@ -123,6 +589,52 @@ void YoutubeAPIManager::ignoreSSLErrors(QNetworkReply* reply,QList<QSslError> er
    reply->ignoreSslErrors(errors);
 }
 
+void YoutubeAPIManager::setPrefetchEnabled(const bool &enabled)
+{
+    Q_D(YoutubeAPIManager);
+
+    d->prefetchEnabled = enabled;
+    if(!enabled) d->prefetchedPages.clear();
+}
+
+QVariantMap YoutubeAPIManager::transferStatistics() const
+{
+    Q_D(const YoutubeAPIManager);
+
+    QVariantMap statistics;
+    foreach(QString endpoint, d->transferCount.keys())
+    {
+        QVariantMap endpointStatistics;
+        endpointStatistics.insert("requests", d->transferCount.value(endpoint));
+        endpointStatistics.insert("transferred", d->transferredBytes.value(endpoint));
+        endpointStatistics.insert("payload", d->payloadBytes.value(endpoint));
+        endpointStatistics.insert("measuredPayload", d->measuredPayloadBytes.value(endpoint));
+        endpointStatistics.insert("unmeasured", d->unmeasuredTransfers.value(endpoint));
+        statistics.insert(endpoint, endpointStatistics);
+    }
+    return statistics;
+}
+
+void YoutubeAPIManager::addQueuedID(const QString &id)
+{
+    Q_D(YoutubeAPIManager);
+    ++d->queuedIDs[id];
+}
+
+void YoutubeAPIManager::removeQueuedID(const QString &id)
+{
+    Q_D(YoutubeAPIManager);
+
+    if(!d->queuedIDs.contains(id)) return;
+    if(--d->queuedIDs[id] <= 0) d->queuedIDs.remove(id);
+}
+
+void YoutubeAPIManager::clearQueuedIDs()
+{
+    Q_D(YoutubeAPIManager);
+    d->queuedIDs.clear();
+}
+
 void YoutubeAPIManager::setMusicOnlyFilter(const bool &onlyMusic)
 {
     Q_D(YoutubeAPIManager);
@@ -141,11 +653,18 @@ void YoutubeAPIManager::setDurationFilter(YoutubeAPIManager::DurationFilter dura
     d->durationFilter = durationFilter;
 }
 
-void YoutubeAPIManager::search(const QString &search, const QString &nextPageToken)
+int YoutubeAPIManager::search(SearchResultsModel *model, const QString &search, const QString &nextPageToken)
 {
     Q_D(YoutubeAPIManager);
 
-    d->searchDocument = QJsonDocument();
+    //A new query supersedes whatever is still loading into the same model, prefetches included
+    if(model && nextPageToken.isEmpty())
+    {
+        foreach(SearchRequest *request, d->searchRequests.values())
+        {
+            if(request->model == model || request->origin == model) cancelSearch(request->id);
+        }
+    }
 
     QString orderBy;
     switch(d->orderFilter)
@@ -183,25 +702,151 @@ void YoutubeAPIManager::search(const QString &search, const QString &nextPageTok
         break;
     }
 
-    QString pageTokenParameter = nextPageToken.isEmpty() ? "" : "&pageToken=" + nextPageToken;
-    QString musicFilter = d->onlyMusic ? "&videoCategoryId=10" : "";
+    QString cacheKey = SearchCache::key(search, orderBy, videoDurationStr, d->onlyMusic, nextPageToken);
 
-    QUrl url("https://www.googleapis.com/youtube/v3/search?part=snippet&q=" + search + "&type=video&videoDuration=" + videoDurationStr +
-             "&maxResults=50" + musicFilter + "&order=" + orderBy + pageTokenParameter + "&key=" + d->youtubeAPIKey);
+    //The page is already being prefetched, hand it over to the caller
+    foreach(SearchRequest *request, d->searchRequests.values())
+    {
+        if(!request->prefetch || request->cacheKey != cacheKey) continue;
+
+        request->prefetch = false;
+        request->model = model;
+        if(request->model) request->model->appendResults(request->results);
+        return request->id;
+    }
+
+    SearchRequest *request = new SearchRequest;
+    request->id = ++d->lastSearchRequestID;
+    request->model = model;
+    request->query = search;
+    request->pageToken = nextPageToken;
+    request->orderBy = orderBy;
+    request->duration = videoDurationStr;
+    request->onlyMusic = d->onlyMusic;
+    request->page = nextPageToken.isEmpty() ? 0 : d->searchPages.value(nextPageToken, 1);
+    request->cacheKey = cacheKey;
+    d->searchRequests.insert(request->id, request);
+
+    QJsonDocument cachedPage;
+    QJsonDocument *prefetchedPage = d->prefetchedPages.take(cacheKey);
+    if(prefetchedPage)
+    {
+        cachedPage = *prefetchedPage;
+        delete prefetchedPage;
+    }
+    else
+    {
+        cachedPage = d->searchCache->page(request->cacheKey);
+        request->fromCache = !cachedPage.isNull();
+    }
+
+    if(!cachedPage.isNull())
+    {
+        request->results = pageResults(cachedPage);
+        request->nextPageToken = cachedPage.object().value("nextPageToken").toString();
+
+        if(request->model) request->model->appendResults(request->results);
+
+        //Deliver on the next event loop pass so the caller already holds the request ID
+        QMetaObject::invokeMethod(this, "searchCompleted", Qt::QueuedConnection, Q_ARG(int, request->id));
+        return request->id;
+    }
+
+    //Throttled requests fail on the next event loop pass, like cached pages complete
+    if(!sendSearchRequest(request)) QMetaObject::invokeMethod(this, "searchDropped", Qt::QueuedConnection, Q_ARG(int, request->id));
+
+    return request->id;
+}
+
+bool YoutubeAPIManager::sendSearchRequest(SearchRequest *request)
+{
+    Q_D(YoutubeAPIManager);
+
+    APIRateLimiter::Priority priority = request->prefetch ? APIRateLimiter::PRIORITY_BACKGROUND : APIRateLimiter::PRIORITY_ESSENTIAL;
+    if(!APIRateLimiter::singleton()->acquire(APIRateLimiter::ENDPOINT_SEARCH, priority)) return false;
+
+    QString pageTokenParameter = request->pageToken.isEmpty() ? "" : "&pageToken=" + request->pageToken;
+    QString musicFilter = request->onlyMusic ? "&videoCategoryId=10" : "";
+
+    QUrl url("https://www.googleapis.com/youtube/v3/search?part=snippet&q=" + request->query + "&type=video&videoDuration=" + request->duration +
+             "&maxResults=50" + musicFilter + "&order=" + request->orderBy + pageTokenParameter + "&fields=" + SEARCH_FIELDS + "&key=" + d->youtubeAPIKey);
     qDebug() << url;
 
-    QNetworkRequest request(url);
-    QNetworkReply* reply = d->networkManager->get(request);
+    QNetworkReply* reply = d->networkManager->get(apiRequest(url));
+    reply->setProperty("requestID", request->id);
+    request->reply = reply;
     connect(reply, SIGNAL(finished()), SLOT(searchFinished()));
     connect(reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(searchError(QNetworkReply::NetworkError)));
 
-    QTimer *timer = new QTimer(this);
-    timer->setSingleShot(true);
-    timer->setInterval(TIMEOUT_INTERVAL);
-    timer->start();
-    connect(timer, SIGNAL(timeout()), SLOT(searchTimeout()));
+    DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_SEARCH);
+
+    return true;
+}
+
+void YoutubeAPIManager::prefetchSearch(const SearchRequest *origin)
+{
+    Q_D(YoutubeAPIManager);
+
+    if(!d->prefetchEnabled || origin->nextPageToken.isEmpty() || origin->page + 1 >= d->prefetchMaximumPages) return;
+
+    if(d->prefetchQuotaDate != QDate::currentDate())
+    {
+        d->prefetchQuotaDate = QDate::currentDate();
+        d->prefetchQuotaUsed = 0;
+    }
+
+    int cost = APIRateLimiter::cost(APIRateLimiter::ENDPOINT_SEARCH) + APIRateLimiter::cost(APIRateLimiter::ENDPOINT_VIDEOS);
+    if(d->prefetchQuotaUsed + cost > d->prefetchQuota) return;
+    if(!APIRateLimiter::singleton()->canAcquire(APIRateLimiter::ENDPOINT_SEARCH, APIRateLimiter::PRIORITY_BACKGROUND)) return;
+
+    QString cacheKey = SearchCache::key(origin->query, origin->orderBy, origin->duration, origin->onlyMusic, origin->nextPageToken);
+    if(d->prefetchedPages.contains(cacheKey) || d->searchCache->contains(cacheKey)) return;
+
+    foreach(SearchRequest *request, d->searchRequests.values())
+    {
+        if(request->cacheKey == cacheKey) return;
+    }
 
-    d->repliesTimeoutMap.insert(timer, reply);
+    SearchRequest *request = new SearchRequest;
+    request->id = ++d->lastSearchRequestID;
+    request->origin = origin->model;
+    request->query = origin->query;
+    request->pageToken = origin->nextPageToken;
+    request->orderBy = origin->orderBy;
+    request->duration = origin->duration;
+    request->onlyMusic = origin->onlyMusic;
+    request->page = origin->page + 1;
+    request->cacheKey = cacheKey;
+    request->prefetch = true;
+    d->searchRequests.insert(request->id, request);
+
+    if(!sendSearchRequest(request))
+    {
+        d->searchRequests.remove(request->id);
+        delete request;
+        return;
+    }
+
+    d->prefetchQuotaUsed += cost;
+}
+
+void YoutubeAPIManager::cancelSearch(const int &requestID)
+{
+    Q_D(YoutubeAPIManager);
+
+    SearchRequest *request = d->searchRequests.take(requestID);
+    if(!request) return;
+
+    if(request->reply)
+    {
+        QNetworkReply *reply = request->reply;
+        disconnect(reply, 0, this, 0);
+        DeadlineScheduler::singleton()->cancel(reply);
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    delete request;
 }
 
 void YoutubeAPIManager::searchFinished()
@@ -212,102 +857,425 @@ void YoutubeAPIManager::searchFinished()
     if(!reply) return;
 
     const QByteArray replyBA = reply->readAll();
-    removeTimer(reply);
+    countTransfer("search", reply, replyBA);
+    const int requestID = reply->property("requestID").toInt();
+    DeadlineScheduler::singleton()->cancel(reply);
+    APIRateLimiter::singleton()->reportSuccess();
     delete reply;
 
+    SearchRequest *request = d->searchRequests.value(requestID, 0);
+    if(!request) return;
+
     QJsonDocument document = QJsonDocument::fromJson(replyBA);
 
     QJsonObject object = document.object();
     QJsonArray searchItems = object.value("items").toArray();
 
-    QJsonArray items;
+    QStringList videosIDs;
 
-    QString videosCommaSeparated;
     for(int i = 0; i < searchItems.count(); ++i)
     {
         QJsonObject resultObj = searchItems.at(i).toObject();
         QJsonObject typeObj = resultObj.value("id").toObject();
         QString videoID = typeObj.value("videoId").toString();
-        videosCommaSeparated.append(videoID);
-        if(i < searchItems.count() - 1) videosCommaSeparated.append(",");
+        videosIDs.append(videoID);
 
         QJsonObject snippetObj = resultObj.value("snippet").toObject();
+        QString title = snippetObj.value("title").toString();
+        QString thumbnail = snippetObj.value("thumbnails").toObject().value("high").toObject().value("url").toString();
+
+        VideoDetailsStore::singleton()->insert(videoID, title, thumbnail, QString());
+
+        SearchResult result;
+        result.id = videoID;
+        SearchResultsModel::splitTitle(title, &result.title, &result.subTitle);
+        result.thumbnail = thumbnail;
+        result.duration = VideoDetailsStore::singleton()->duration(videoID);
+        request->results.append(result);
+    }
+
+    request->nextPageToken = object.value("nextPageToken").toString();
+
+    if(request->model) request->model->appendResults(request->results);
+
+    QStringList missingIDs = VideoDetailsStore::singleton()->missingDurations(videosIDs);
+
+    if(missingIDs.count()) searchVideosDuration(requestID, missingIDs.join(","));
+    else searchCompleted(requestID);
+}
+
+void YoutubeAPIManager::searchCompleted(const int &requestID)
+{
+    Q_D(YoutubeAPIManager);
+
+    SearchRequest *request = d->searchRequests.take(requestID);
+    if(!request) return;
+
+    //Prefetched pages stay in memory until they are shown, the cache drops the oldest ones when full
+    if(request->prefetch)
+    {
+        d->prefetchedPages.insert(request->cacheKey, new QJsonDocument(pageDocument(request->results, request->nextPageToken)), qMax(1, request->results.count()));
+        delete request;
+        return;
+    }
+
+    if(!request->fromCache) d->searchCache->insert(request->cacheKey, pageDocument(request->results, request->nextPageToken));
+
+    if(request->model) request->model->setNextPageToken(request->nextPageToken);
+
+    if(!request->nextPageToken.isEmpty())
+    {
+        if(d->searchPages.count() > 1000) d->searchPages.clear();
+        d->searchPages.insert(request->nextPageToken, request->page + 1);
+
+        if(request->model) prefetchSearch(request);
+    }
+
+    delete request;
 
-        QJsonObject videoInfoObj;
-        videoInfoObj.insert("id", videoID);
-        videoInfoObj.insert("title", snippetObj.value("title").toString());
-        videoInfoObj.insert("thumbnail", snippetObj.value("thumbnails").toObject().value("high").toObject().value("url").toString());
+    emit searchSuccess(requestID);
+}
+
+void YoutubeAPIManager::countTransfer(const QString &endpoint, QNetworkReply *reply, const QByteArray &payload)
+{
+    Q_D(YoutubeAPIManager);
 
-        items.append(videoInfoObj);
+    //Content-Length is the compressed size on the wire, chunked replies only know the inflated size,
+    //those are kept apart so the transferred figure is only compared with payloads it actually measured
+    QVariant contentLength = reply->header(QNetworkRequest::ContentLengthHeader);
+    if(contentLength.isValid())
+    {
+        d->transferredBytes[endpoint] += contentLength.toLongLong();
+        d->measuredPayloadBytes[endpoint] += payload.size();
+    }
+    else
+    {
+        ++d->unmeasuredTransfers[endpoint];
     }
 
-    JsonHelper::modifyValue(d->searchDocument, "items", items);
+    d->payloadBytes[endpoint] += payload.size();
+    ++d->transferCount[endpoint];
+}
+
+void YoutubeAPIManager::searchFailure(QNetworkReply *reply)
+{
+    const int requestID = reply->property("requestID").toInt();
+
+    disconnect(reply, 0, this, 0);
+    DeadlineScheduler::singleton()->cancel(reply);
+    reply->deleteLater();
+
+    searchDropped(requestID);
+}
+
+void YoutubeAPIManager::searchDropped(const int &requestID)
+{
+    Q_D(YoutubeAPIManager);
+
+    SearchRequest *request = d->searchRequests.take(requestID);
+    if(!request) return;
 
-    if(object.contains("nextPageToken"))
+    bool prefetch = request->prefetch;
+    delete request;
+
+    if(!prefetch) emit searchFailed(requestID);
+}
+
+void YoutubeAPIManager::searchError(QNetworkReply::NetworkError error)
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if(!reply) return;
+
+    APIRateLimiter::singleton()->reportFailure(reply);
+    searchFailure(reply);
+}
+
+void YoutubeAPIManager::searchVideosDuration(const int &requestID, const QString &videosIDs)
+{
+    Q_D(YoutubeAPIManager);
+
+    SearchRequest *request = d->searchRequests.value(requestID, 0);
+    if(!request) return;
+
+    //Without quota left the page is still usable, just without the missing durations
+    APIRateLimiter::Priority priority = request->prefetch ? APIRateLimiter::PRIORITY_BACKGROUND : APIRateLimiter::PRIORITY_ESSENTIAL;
+    if(!APIRateLimiter::singleton()->acquire(APIRateLimiter::ENDPOINT_VIDEOS, priority))
     {
-        JsonHelper::modifyValue(d->searchDocument, "nextPageToken", object.value("nextPageToken").toString());
+        searchCompleted(requestID);
+        return;
+    }
+
+    QUrl url("https://www.googleapis.com/youtube/v3/videos?id=" + videosIDs + "&part=contentDetails&fields=" + VIDEOS_FIELDS + "&key=" + d->youtubeAPIKey);
+    QNetworkReply* reply = d->networkManager->get(apiRequest(url));
+    reply->setProperty("requestID", requestID);
+    request->reply = reply;
+    connect(reply, SIGNAL(finished()), SLOT(searchVideosDurationFinished()));
+    connect(reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(searchError(QNetworkReply::NetworkError)));
+
+    DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_VIDEOS);
+}
+
+void YoutubeAPIManager::searchVideosDurationFinished()
+{
+    Q_D(YoutubeAPIManager);
+
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if(!reply) return;
+
+    const QByteArray replyBA = reply->readAll();
+    countTransfer("videos", reply, replyBA);
+    const int requestID = reply->property("requestID").toInt();
+    DeadlineScheduler::singleton()->cancel(reply);
+    APIRateLimiter::singleton()->reportSuccess();
+    delete reply;
+
+    SearchRequest *request = d->searchRequests.value(requestID, 0);
+    if(!request) return;
+
+    QJsonDocument document = QJsonDocument::fromJson(replyBA);
+
+    QJsonObject object = document.object();
+    QJsonArray searchItems = object.value("items").toArray();
+
+    for(int i = 0; i < searchItems.count(); ++i)
+    {
+        QJsonObject resultObj = searchItems.at(i).toObject();
+        QString videoID = resultObj.value("id").toString();
+        QJsonObject detailsObj = resultObj.value("contentDetails").toObject();
+        QString duration = formatDuration(detailsObj.value("duration").toString());
+
+        if(duration.isEmpty()) continue;
+
+        VideoDetailsStore::singleton()->insert(videoID, QString(), QString(), duration);
+        if(request->model) request->model->setDuration(videoID, duration);
+    }
+
+    for(int i = 0; i < request->results.count(); ++i)
+    {
+        if(!request->results.at(i).duration.isEmpty()) continue;
+        request->results[i].duration = VideoDetailsStore::singleton()->duration(request->results.at(i).id);
+    }
+
+    searchCompleted(requestID);
+}
+
+void YoutubeAPIManager::suggestion(const QString &id)
+{
+    Q_D(YoutubeAPIManager);
+
+    if(d->suggestionPools.contains(id) && QDateTime::currentMSecsSinceEpoch() - d->suggestionPools.value(id).created > SUGGESTION_POOL_TTL)
+    {
+        d->suggestionPools.remove(id);
+    }
+
+    if(serveSuggestion(id)) return;
+
+    //An exhausted pool without more pages starts over, related results shift over time
+    if(d->suggestionPools.contains(id) && !d->suggestionPools.value(id).refilling && d->suggestionPools.value(id).nextPageToken.isEmpty())
+    {
+        d->suggestionPools.remove(id);
+    }
+
+    //Nothing usable yet, the suggestion is served as soon as the pool is filled
+    d->pendingSuggestionSeed = id;
+    if(d->suggestionPools.value(id).refilling) return;
+
+    if(!requestSuggestionPool(id))
+    {
+        d->pendingSuggestionSeed = "";
+        QMetaObject::invokeMethod(this, "suggestionFailed", Qt::QueuedConnection);
+    }
+}
+
+bool YoutubeAPIManager::requestSuggestionPool(const QString &seed)
+{
+    Q_D(YoutubeAPIManager);
+
+    //Suggestions are background work, back off instead of spending the remaining quota on retries
+    if(!APIRateLimiter::singleton()->acquire(APIRateLimiter::ENDPOINT_SEARCH, APIRateLimiter::PRIORITY_BACKGROUND)) return false;
+
+    if(!d->suggestionPools.contains(seed) && d->suggestionPools.count() >= SUGGESTION_POOLS_MAXIMUM)
+    {
+        QString oldestSeed;
+        foreach(QString poolSeed, d->suggestionPools.keys())
+        {
+            if(oldestSeed.isEmpty() || d->suggestionPools.value(poolSeed).created < d->suggestionPools.value(oldestSeed).created) oldestSeed = poolSeed;
+        }
+        d->suggestionPools.remove(oldestSeed);
+    }
+
+    SuggestionPool& pool = d->suggestionPools[seed];
+    if(!pool.created) pool.created = QDateTime::currentMSecsSinceEpoch();
+    pool.refilling = true;
+
+    QString videoDurationStr;
+    switch(d->durationFilter)
+    {
+    case DURATION_SHORT:
+        videoDurationStr = "short";
+        break;
+    case DURATION_MEDIUM:
+        videoDurationStr = "medium";
+        break;
+    case DURATION_LONG:
+        videoDurationStr = "long";
+        break;
+    case DURATION_ANY:
+    default:
+        videoDurationStr = "any";
+        break;
+    }
+
+    QString musicFilter = d->onlyMusic ? "&videoCategoryId=10" : "";
+    QString pageTokenParameter = pool.nextPageToken.isEmpty() ? "" : "&pageToken=" + pool.nextPageToken;
+
+    QUrl url("https://www.googleapis.com/youtube/v3/search?part=snippet&type=video&maxResults=30&relatedToVideoId=" + seed + "&videoDuration=" + videoDurationStr +
+             musicFilter + pageTokenParameter + "&fields=" + SEARCH_FIELDS + "&key=" + d->youtubeAPIKey);
+    qDebug() << url;
+
+    QNetworkReply* reply = d->networkManager->get(apiRequest(url));
+    reply->setProperty("seed", seed);
+    connect(reply, SIGNAL(finished()), SLOT(suggestionFinished()));
+    connect(reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(suggestionError(QNetworkReply::NetworkError)));
+
+    DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_SUGGESTION);
+
+    return true;
+}
+
+bool YoutubeAPIManager::serveSuggestion(const QString &seed)
+{
+    Q_D(YoutubeAPIManager);
+
+    if(!d->suggestionPools.contains(seed)) return false;
+
+    SuggestionPool& pool = d->suggestionPools[seed];
+
+    //Drop candidates queued or played since the pool was filled and those whose duration never arrived
+    for(int i = pool.candidates.count() - 1; i >= 0; --i)
+    {
+        const VideoDetails& candidate = pool.candidates.at(i);
+        if(d->excluded(candidate.id) || (candidate.duration.isEmpty() && !pool.refilling)) pool.candidates.removeAt(i);
+    }
+
+    QList<int> usableIndexes;
+    for(int i = 0; i < pool.candidates.count(); ++i)
+    {
+        if(!pool.candidates.at(i).duration.isEmpty()) usableIndexes.append(i);
+    }
+
+    if(usableIndexes.isEmpty()) return false;
+
+    VideoDetails selected = pool.candidates.takeAt(usableIndexes.at(rand() % usableIndexes.count()));
+
+    if(pool.candidates.count() < SUGGESTION_POOL_LOW && !pool.refilling && !pool.nextPageToken.isEmpty()) requestSuggestionPool(seed);
+
+    //Callers expect the answer asynchronously, as it was when every suggestion hit the network
+    QMetaObject::invokeMethod(this, "suggestionSuccess", Qt::QueuedConnection, Q_ARG(QString, selected.id), Q_ARG(QString, selected.title),
+                              Q_ARG(QString, selected.thumbnail), Q_ARG(QString, selected.duration));
+    return true;
+}
+
+void YoutubeAPIManager::suggestionFinished()
+{
+    Q_D(YoutubeAPIManager);
+
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if(!reply) return;
+
+    const QByteArray replyBA = reply->readAll();
+    const QString seed = reply->property("seed").toString();
+    countTransfer("search", reply, replyBA);
+    DeadlineScheduler::singleton()->cancel(reply);
+    APIRateLimiter::singleton()->reportSuccess();
+    delete reply;
+
+    if(!d->suggestionPools.contains(seed)) return;
+
+    QJsonDocument document = QJsonDocument::fromJson(replyBA);
+    QJsonObject object = document.object();
+    QJsonArray searchItems = object.value("items").toArray();
+
+    SuggestionPool& pool = d->suggestionPools[seed];
+    pool.nextPageToken = object.value("nextPageToken").toString();
+
+    QStringList videosIDs;
+
+    for(int i = 0; i < searchItems.count(); ++i)
+    {
+        QJsonObject resultObj = searchItems.at(i).toObject();
+        QString videoID = resultObj.value("id").toObject().value("videoId").toString();
+        if(videoID.isEmpty() || videosIDs.contains(videoID)) continue;
+
+        QJsonObject snippetObj = resultObj.value("snippet").toObject();
+        QString title = snippetObj.value("title").toString();
+        QString thumbnail = snippetObj.value("thumbnails").toObject().value("high").toObject().value("url").toString();
+
+        VideoDetailsStore::singleton()->insert(videoID, title, thumbnail, QString());
+
+        VideoDetails candidate;
+        candidate.id = videoID;
+        candidate.title = title;
+        candidate.thumbnail = thumbnail;
+        candidate.duration = VideoDetailsStore::singleton()->duration(videoID);
+        pool.candidates.append(candidate);
+        videosIDs.append(videoID);
     }
 
-    if(searchItems.count()) searchVideosDuration(videosCommaSeparated);
-    else emit searchSuccess(QString(d->searchDocument.toJson()));
-}
-
-void YoutubeAPIManager::searchError(QNetworkReply::NetworkError error)
-{
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    if(!reply) return;
+    //Durations for the whole pool come in one videos call
+    QStringList missingIDs = VideoDetailsStore::singleton()->missingDurations(videosIDs);
+    if(missingIDs.count() && APIRateLimiter::singleton()->acquire(APIRateLimiter::ENDPOINT_VIDEOS, APIRateLimiter::PRIORITY_BACKGROUND))
+    {
+        QUrl url("https://www.googleapis.com/youtube/v3/videos?id=" + missingIDs.join(",") + "&part=contentDetails&fields=" + VIDEOS_FIELDS + "&key=" + d->youtubeAPIKey);
+        QNetworkReply* durationsReply = d->networkManager->get(apiRequest(url));
+        durationsReply->setProperty("seed", seed);
+        connect(durationsReply, SIGNAL(finished()), SLOT(suggestionDurationsFinished()));
+        connect(durationsReply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(suggestionDurationsError(QNetworkReply::NetworkError)));
 
-    emit searchFailed();
+        DeadlineScheduler::singleton()->schedule(durationsReply, DeadlineScheduler::REQUEST_VIDEOS);
+        return;
+    }
 
-    removeTimer(reply);
-    delete reply;
+    suggestionPoolReady(seed);
 }
 
-void YoutubeAPIManager::searchTimeout()
+void YoutubeAPIManager::suggestionError(QNetworkReply::NetworkError error)
 {
     Q_D(YoutubeAPIManager);
 
-    QTimer *timer = qobject_cast<QTimer*>(sender());
-
-    if(!timer) return;
-
-    QNetworkReply *reply = d->repliesTimeoutMap.value(timer, 0);
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
     if(!reply) return;
 
-    emit searchFailed();
+    APIRateLimiter::singleton()->reportFailure(reply);
 
-    removeTimer(reply);
-    delete reply;
-}
+    const QString seed = reply->property("seed").toString();
 
-void YoutubeAPIManager::searchVideosDuration(const QString &videosIDs)
-{
-    Q_D(YoutubeAPIManager);
+    disconnect(reply, 0, this, 0);
+    DeadlineScheduler::singleton()->cancel(reply);
+    reply->deleteLater();
 
-    QUrl url("https://www.googleapis.com/youtube/v3/videos?id=" + videosIDs + "&part=contentDetails&key=" + d->youtubeAPIKey);
-    QNetworkRequest request(url);
-    QNetworkReply* reply = d->networkManager->get(request);
-    connect(reply, SIGNAL(finished()), SLOT(searchVideosDurationFinished()));
-    connect(reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(searchVideosDurationError(QNetworkReply::NetworkError)));
+    if(d->suggestionPools.contains(seed))
+    {
+        d->suggestionPools[seed].refilling = false;
+        if(d->suggestionPools.value(seed).candidates.isEmpty()) d->suggestionPools.remove(seed);
+    }
 
-    QTimer *timer = new QTimer(this);
-    timer->setSingleShot(true);
-    timer->setInterval(TIMEOUT_INTERVAL);
-    timer->start();
-    connect(timer, SIGNAL(timeout()), SLOT(searchVideosDurationTimeout()));
+    if(d->pendingSuggestionSeed != seed) return;
 
-    d->repliesTimeoutMap.insert(timer, reply);
+    d->pendingSuggestionSeed = "";
+    emit suggestionFailed();
 }
 
-void YoutubeAPIManager::searchVideosDurationFinished()
+void YoutubeAPIManager::suggestionDurationsFinished()
 {
-    Q_D(YoutubeAPIManager);
-
     QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
     if(!reply) return;
 
     const QByteArray replyBA = reply->readAll();
-    removeTimer(reply);
+    const QString seed = reply->property("seed").toString();
+    countTransfer("videos", reply, replyBA);
+    DeadlineScheduler::singleton()->cancel(reply);
+    APIRateLimiter::singleton()->reportSuccess();
     delete reply;
 
     QJsonDocument document = QJsonDocument::fromJson(replyBA);
@@ -320,409 +1288,468 @@ void YoutubeAPIManager::searchVideosDurationFinished()
         QJsonObject resultObj = searchItems.at(i).toObject();
         QString videoID = resultObj.value("id").toString();
         QJsonObject detailsObj = resultObj.value("contentDetails").toObject();
-        QString videoDuration = detailsObj.value("duration").toString();
-
-        if(!videoDuration.startsWith("PT")) continue;
-
-        videoDuration = videoDuration.remove(0, 2);
-        QString hoursStr, minutesStr, secondsStr;
-
-        //Hours
-        if(videoDuration.contains("H"))
-        {
-            hoursStr = videoDuration.left(videoDuration.indexOf("H"));
-            if(hoursStr.count() < 2) hoursStr.insert(0, "0");
-            videoDuration = videoDuration.remove(0, videoDuration.indexOf("H") + 1);
-        }
-
-        //Minutes
-        {
-            if(videoDuration.contains("M")) {
-                minutesStr = videoDuration.left(videoDuration.indexOf("M"));
-            }
-            while (minutesStr.count() < 2) minutesStr.insert(0, "0");
-            videoDuration = videoDuration.remove(0, videoDuration.indexOf("M") + 1);
-        }
-
-        //Seconds
-        {
-            secondsStr = videoDuration.left(videoDuration.indexOf("S"));
-            while (secondsStr.count() < 2) secondsStr.insert(0, "0");
-        }
-
-        QString duration;
-        if(hoursStr.count()) duration.append(hoursStr + ":");
-        if(minutesStr.count()) duration.append(minutesStr + ":");
-        duration.append(secondsStr);
-
-        QJsonArray items = d->searchDocument.object().value("items").toArray();
-        QJsonObject item = items.at(i).toObject();
-        items.removeAt(i);
+        QString duration = formatDuration(detailsObj.value("duration").toString());
 
-        item.insert("duration", duration);
-        items.insert(i, item);
+        if(duration.isEmpty()) continue;
 
-        JsonHelper::modifyValue(d->searchDocument, "items", items);
+        VideoDetailsStore::singleton()->insert(videoID, QString(), QString(), duration);
     }
 
-    emit searchSuccess(QString(d->searchDocument.toJson()));
+    suggestionPoolReady(seed);
 }
 
-void YoutubeAPIManager::searchVideosDurationError(QNetworkReply::NetworkError error)
+void YoutubeAPIManager::suggestionDurationsError(QNetworkReply::NetworkError error)
 {
     QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
     if(!reply) return;
 
-    emit searchFailed();
+    APIRateLimiter::singleton()->reportFailure(reply);
 
-    removeTimer(reply);
-    delete reply;
+    const QString seed = reply->property("seed").toString();
+
+    disconnect(reply, 0, this, 0);
+    DeadlineScheduler::singleton()->cancel(reply);
+    reply->deleteLater();
+
+    //Candidates with a known duration can still be served
+    suggestionPoolReady(seed);
 }
 
-void YoutubeAPIManager::searchVideosDurationTimeout()
+void YoutubeAPIManager::suggestionPoolReady(const QString &seed)
 {
     Q_D(YoutubeAPIManager);
 
-    QTimer *timer = qobject_cast<QTimer*>(sender());
-
-    if(!timer) return;
+    if(d->suggestionPools.contains(seed))
+    {
+        SuggestionPool& pool = d->suggestionPools[seed];
+        pool.refilling = false;
 
-    QNetworkReply *reply = d->repliesTimeoutMap.value(timer, 0);
-    if(!reply) return;
+        for(int i = 0; i < pool.candidates.count(); ++i)
+        {
+            if(pool.candidates.at(i).duration.isEmpty()) pool.candidates[i].duration = VideoDetailsStore::singleton()->duration(pool.candidates.at(i).id);
+        }
+    }
 
-    emit searchFailed();
+    if(d->pendingSuggestionSeed != seed) return;
 
-    removeTimer(reply);
-    delete reply;
+    d->pendingSuggestionSeed = "";
+    if(!serveSuggestion(seed)) emit suggestionFailed();
 }
 
-void YoutubeAPIManager::suggestion(const QString &id, const QStringList excludeSuggestionIDs)
+int YoutubeAPIManager::videoUrl(const QString &videoID, const bool &withVideo)
 {
     Q_D(YoutubeAPIManager);
 
-    d->excludeSuggestionIDs = excludeSuggestionIDs;
+    //The token identifies this request, results carrying an older one are stale
+    const int token = ++d->videoUrlToken;
+    d->videoUrlWithVideo = withVideo;
 
-    QString videoDurationStr;
-    switch(d->durationFilter)
+    //Only the latest request is played, an older one still resolving is dropped unless it was resolving ahead
+    if(d->videoUrlRequestID && !d->preresolveRequests.contains(d->videoUrlRequestID))
     {
-    case DURATION_SHORT:
-        videoDurationStr = "short";
-        break;
-    case DURATION_MEDIUM:
-        videoDurationStr = "medium";
-        break;
-    case DURATION_LONG:
-        videoDurationStr = "long";
-        break;
-    case DURATION_ANY:
-    default:
-        videoDurationStr = "any";
-        break;
+        if(!d->durationRequests.contains(d->videoUrlRequestID)) d->urlPool->cancel(d->videoUrlRequestID);
+        d->urlRequestIDs.remove(d->urlRequests.take(d->videoUrlRequestID));
     }
+    d->videoUrlRequestID = 0;
 
-    QString musicFilter = d->onlyMusic ? "&videoCategoryId=10" : "";
-
-    QUrl url("https://www.googleapis.com/youtube/v3/search?part=snippet&type=video&maxResults=30&relatedToVideoId=" + id + "&videoDuration=" + videoDurationStr +
-             musicFilter + "&key=" + d->youtubeAPIKey);
-    qDebug() << url;
+    //The first request goes out right away, the ones following it quickly wait until the user settles
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const bool skipping = now - d->lastVideoUrlRequest < d->videoUrlDebounceTimer->interval();
+    d->lastVideoUrlRequest = now;
 
-    QNetworkRequest request(url);
-    QNetworkReply* reply = d->networkManager->get(request);
-    connect(reply, SIGNAL(finished()), SLOT(suggestionFinished()));
-    connect(reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(suggestionError(QNetworkReply::NetworkError)));
+    if(skipping)
+    {
+        d->debouncedVideoID = videoID;
+        d->videoUrlDebounceTimer->start();
+        return token;
+    }
 
-    QTimer *timer = new QTimer(this);
-    timer->setSingleShot(true);
-    timer->setInterval(TIMEOUT_INTERVAL);
-    timer->start();
-    connect(timer, SIGNAL(timeout()), SLOT(suggestionTimeout()));
+    d->debouncedVideoID.clear();
+    d->videoUrlDebounceTimer->stop();
+    resolveVideoUrl(videoID);
 
-    d->repliesTimeoutMap.insert(timer, reply);
+    return token;
 }
 
-void YoutubeAPIManager::suggestionFinished()
+void YoutubeAPIManager::videoUrlDebounced()
 {
     Q_D(YoutubeAPIManager);
 
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    if(!reply) return;
+    if(d->debouncedVideoID.isEmpty()) return;
 
-    const QByteArray replyBA = reply->readAll();
-    removeTimer(reply);
-    delete reply;
+    QString videoID = d->debouncedVideoID;
+    d->debouncedVideoID.clear();
 
-    QJsonDocument document = QJsonDocument::fromJson(replyBA);
-    QJsonObject object = document.object();
-    QJsonArray searchItems = object.value("items").toArray();
+    resolveVideoUrl(videoID);
+}
+
+void YoutubeAPIManager::resolveVideoUrl(const QString &videoID)
+{
+    Q_D(YoutubeAPIManager);
 
-    bool alreadySuggested = true;
-    QString selectedID;
-    QJsonObject resultObj;
+    d->appendHistory(videoID);
 
-    while(alreadySuggested && !searchItems.isEmpty())
+    //A cached copy plays without resolving or streaming anything, it only holds the audio
+    QString filePath = d->videoUrlWithVideo ? QString() : MediaCache::singleton()->file(videoID);
+    if(!filePath.isEmpty())
     {
-        int selectedIndex = rand() % searchItems.count();
+        QMetaObject::invokeMethod(this, "videoUrlSuccess", Qt::QueuedConnection, Q_ARG(QString, videoID), Q_ARG(QString, QUrl::fromLocalFile(filePath).toString()), Q_ARG(int, d->videoUrlToken));
+        return;
+    }
 
-        resultObj = searchItems.takeAt(selectedIndex).toObject();
-        QJsonObject typeObj = resultObj.value("id").toObject();
-        selectedID = typeObj.value("videoId").toString();
-        if(!d->excludeSuggestionIDs.contains(selectedID)) alreadySuggested = false;
+    QString url = d->playbackStreamUrl(videoID, d->videoUrlWithVideo);
+    if(!url.isEmpty())
+    {
+        d->cacheMedia(videoID);
+        QMetaObject::invokeMethod(this, "videoUrlSuccess", Qt::QueuedConnection, Q_ARG(QString, videoID), Q_ARG(QString, StreamBuffer::singleton()->playbackUrl(videoID, url)), Q_ARG(int, d->videoUrlToken));
+        return;
     }
 
-    if(selectedID.isEmpty() || searchItems.isEmpty())
+    //Already being resolved ahead of time, wait for that one
+    int requestID = d->urlRequestIDs.value(videoID, 0);
+    if(requestID)
     {
-        emit suggestionFailed();
+        d->videoUrlRequestID = requestID;
         return;
     }
 
-    QJsonObject snippetObj = resultObj.value("snippet").toObject();
-    QString thumbnail = snippetObj.value("thumbnails").toObject().value("high").toObject().value("url").toString();
-    QString title = snippetObj.value("title").toString();
+    //The same extraction may already be running for the duration
+    requestID = d->durationRequestIDs.value(videoID, 0);
+    if(requestID)
+    {
+        d->urlPool->promote(requestID);
+        d->videoUrlRequestID = requestID;
+        d->urlRequests.insert(requestID, videoID);
+        d->urlRequestIDs.insert(videoID, requestID);
+        return;
+    }
 
-    suggestionVideoDuration(selectedID, title, thumbnail);
+    d->videoUrlRequestID = d->urlPool->resolve(videoID);
+    d->urlRequests.insert(d->videoUrlRequestID, videoID);
+    d->urlRequestIDs.insert(videoID, d->videoUrlRequestID);
 }
 
-void YoutubeAPIManager::suggestionError(QNetworkReply::NetworkError error)
+void YoutubeAPIManager::preresolveVideoUrl(const QString &videoID)
 {
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    if(!reply) return;
+    Q_D(YoutubeAPIManager);
 
-    emit suggestionFailed();
+    if(videoID.isEmpty() || MediaCache::singleton()->contains(videoID)) return;
 
-    removeTimer(reply);
-    delete reply;
+    QString url = d->playbackStreamUrl(videoID, false);
+    if(!url.isEmpty())
+    {
+        StreamBuffer::singleton()->prefetch(videoID, url);
+        return;
+    }
+
+    if(d->urlRequestIDs.contains(videoID)) return;
+
+    int requestID = d->durationRequestIDs.value(videoID, 0);
+    if(requestID) d->urlPool->promote(requestID);
+    else requestID = d->urlPool->resolve(videoID);
+    d->urlRequests.insert(requestID, videoID);
+    d->urlRequestIDs.insert(videoID, requestID);
+    d->preresolveRequests.insert(requestID);
 }
 
-void YoutubeAPIManager::suggestionTimeout()
+QString YoutubeAPIManager::prerollVideoUrl(const QString &videoID, const bool &withVideo)
 {
     Q_D(YoutubeAPIManager);
 
-    QTimer *timer = qobject_cast<QTimer*>(sender());
+    if(videoID.isEmpty()) return QString();
 
-    if(!timer) return;
+    if(!withVideo && MediaCache::singleton()->contains(videoID))
+    {
+        QString filePath = MediaCache::singleton()->file(videoID);
+        if(!filePath.isEmpty()) return QUrl::fromLocalFile(filePath).toString();
+    }
 
-    QNetworkReply *reply = d->repliesTimeoutMap.value(timer, 0);
-    if(!reply) return;
+    QString url = d->playbackStreamUrl(videoID, withVideo);
+    if(!url.isEmpty()) return StreamBuffer::singleton()->prerollUrl(videoID, url);
 
-    emit suggestionFailed();
+    //Not resolved yet, the standby player asks again on its next check
+    preresolveVideoUrl(videoID);
+    return QString();
+}
 
-    removeTimer(reply);
-    delete reply;
+void YoutubeAPIManager::prerolledVideoPlayed(const QString &videoID)
+{
+    Q_D(YoutubeAPIManager);
+
+    //A prerolled track never went through videoUrl, record it once it is actually heard
+    StreamBuffer::singleton()->prerollPlayed(videoID);
+    d->appendHistory(videoID);
+    d->cacheMedia(videoID);
 }
-void YoutubeAPIManager::suggestionVideoDuration(const QString &id, const QString &title, const QString &thumbnail)
+
+QVariantMap YoutubeAPIManager::videoInfo(const QString &videoID)
 {
     Q_D(YoutubeAPIManager);
 
-    QUrl url("https://www.googleapis.com/youtube/v3/videos?id=" + id + "&part=contentDetails&key=" + d->youtubeAPIKey);
-    QNetworkRequest request(url);
-    QNetworkReply* reply = d->networkManager->get(request);
-    connect(reply, SIGNAL(finished()), SLOT(suggestionVideoDurationFinished()));
-    connect(reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(suggestionVideoDurationError(QNetworkReply::NetworkError)));
+    QVariantMap info;
 
-    reply->setProperty("id", id);
-    reply->setProperty("title", title);
-    reply->setProperty("thumbnail", thumbnail);
+    VideoDetails details = VideoDetailsStore::singleton()->details(videoID);
+    info.insert("id", videoID);
+    info.insert("title", details.title);
+    info.insert("thumbnail", details.thumbnail);
+    info.insert("duration", details.duration);
 
-    QTimer *timer = new QTimer(this);
-    timer->setSingleShot(true);
-    timer->setInterval(TIMEOUT_INTERVAL);
-    timer->start();
-    connect(timer, SIGNAL(timeout()), SLOT(suggestionVideoDurationTimeout()));
+    QString url = d->streamUrl(videoID);
+    if(!url.isEmpty())
+    {
+        info.insert("url", url);
+        info.insert("expires", QDateTime::fromMSecsSinceEpoch(d->streamUrls.value(videoID).expires));
+        info.insert("formats", d->streamUrls.value(videoID).formats);
+    }
 
-    d->repliesTimeoutMap.insert(timer, reply);
+    return info;
 }
 
-void YoutubeAPIManager::suggestionVideoDurationFinished()
+void YoutubeAPIManager::videoInfoFinished(const int &requestID, const QString &videoID, const QByteArray &output, const int &elapsed)
 {
     Q_D(YoutubeAPIManager);
 
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    if(!reply) return;
-
-    const QByteArray replyBA = reply->readAll();
-    removeTimer(reply);
+    Q_UNUSED(elapsed)
 
-    QString id = reply->property("id").toString();
-    QString title = reply->property("title").toString();
-    QString thumbnail = reply->property("thumbnail").toString();
+    const bool urlRequested = d->urlRequests.remove(requestID);
+    const bool durationRequested = d->durationRequests.remove(requestID);
+    if(!urlRequested && !durationRequested) return;
+    if(urlRequested) d->urlRequestIDs.remove(videoID);
+    if(durationRequested)
+    {
+        d->durationRequestIDs.remove(videoID);
+        d->durationIDs.remove(videoID);
+    }
+    const bool preresolved = d->preresolveRequests.remove(requestID);
 
-    delete reply;
+    VideoInfo info = parseVideoInfo(output);
 
-    QJsonDocument document = QJsonDocument::fromJson(replyBA);
+    //Everything extracted is kept, whichever request asked for it
+    VideoDetailsStore::singleton()->insert(videoID, info.title, info.thumbnail, info.duration);
+    if(!info.url.isEmpty()) d->insertStreamUrl(videoID, info.url, info.formats);
+    if(urlRequested) d->cacheMedia(videoID);
 
-    QJsonObject object = document.object();
-    QJsonArray searchItems = object.value("items").toArray();
+    if(durationRequested)
+    {
+        if(!info.duration.isEmpty()) emit videoDurationSuccess(videoID, info.duration);
+        else emit videoDurationFailed(videoID);
 
-    QJsonObject resultObj = searchItems.at(0).toObject();
-    QJsonObject detailsObj = resultObj.value("contentDetails").toObject();
-    QString videoDuration = detailsObj.value("duration").toString();
+        emit durationQueueDepthChanged(durationQueueDepth());
+    }
 
-    if(!videoDuration.startsWith("PT"))
+    if(requestID != d->videoUrlRequestID)
     {
-        emit suggestionFailed();
+        //The next track starts from memory when it is played
+        if(preresolved) StreamBuffer::singleton()->prefetch(videoID, d->playbackStreamUrl(videoID, false));
         return;
     }
+    d->videoUrlRequestID = 0;
 
-    videoDuration = videoDuration.remove(0, 2);
-    QString hoursStr, minutesStr, secondsStr;
+    QString url = d->playbackStreamUrl(videoID, d->videoUrlWithVideo);
+    if(!url.isEmpty()) emit videoUrlSuccess(videoID, StreamBuffer::singleton()->playbackUrl(videoID, url), d->videoUrlToken);
+    else emit videoUrlFailed(videoID, d->videoUrlToken);
+}
 
-    //Hours
-    if(videoDuration.contains("H"))
-    {
-        hoursStr = videoDuration.left(videoDuration.indexOf("H"));
-        if(hoursStr.count() < 2) hoursStr.insert(0, "0");
-        videoDuration = videoDuration.remove(0, videoDuration.indexOf("H") + 1);
-    }
+void YoutubeAPIManager::videoInfoError(const int &requestID, const QString &videoID, const QString &error)
+{
+    Q_D(YoutubeAPIManager);
 
-    //Minutes
+    const bool urlRequested = d->urlRequests.remove(requestID);
+    const bool durationRequested = d->durationRequests.remove(requestID);
+    if(!urlRequested && !durationRequested) return;
+    if(urlRequested) d->urlRequestIDs.remove(videoID);
+    if(durationRequested)
     {
-        if(videoDuration.contains("M")) {
-            minutesStr = videoDuration.left(videoDuration.indexOf("M"));
-        }
-        while (minutesStr.count() < 2) minutesStr.insert(0, "0");
-        videoDuration = videoDuration.remove(0, videoDuration.indexOf("M") + 1);
+        d->durationRequestIDs.remove(videoID);
+        d->durationIDs.remove(videoID);
     }
+    d->preresolveRequests.remove(requestID);
 
-    //Seconds
+    qDebug() << "Youtube DL could not resolve" << videoID << error;
+
+    if(durationRequested)
     {
-        secondsStr = videoDuration.left(videoDuration.indexOf("S"));
-        while (secondsStr.count() < 2) secondsStr.insert(0, "0");
+        emit videoDurationFailed(videoID);
+        emit durationQueueDepthChanged(durationQueueDepth());
     }
 
-    QString duration;
-    if(hoursStr.count()) duration.append(hoursStr + ":");
-    if(minutesStr.count()) duration.append(minutesStr + ":");
-    duration.append(secondsStr);
+    if(requestID != d->videoUrlRequestID) return;
+    d->videoUrlRequestID = 0;
 
-    emit suggestionSuccess(id, title, thumbnail, duration);
+    emit videoUrlFailed(videoID, d->videoUrlToken);
 }
 
-void YoutubeAPIManager::suggestionVideoDurationError(QNetworkReply::NetworkError error)
+void YoutubeAPIManager::videoDuration(const QString &videoID)
 {
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    if(!reply) return;
+    Q_D(YoutubeAPIManager);
 
-    emit suggestionFailed();
+    QString duration = VideoDetailsStore::singleton()->duration(videoID);
+    if(!duration.isEmpty())
+    {
+        QMetaObject::invokeMethod(this, "videoDurationSuccess", Qt::QueuedConnection, Q_ARG(QString, videoID), Q_ARG(QString, duration));
+        return;
+    }
 
-    removeTimer(reply);
-    delete reply;
+    //Pending, batched and youtube-dl fallbacks alike, a video already asked for is answered once
+    if(d->durationIDs.contains(videoID)) return;
+    d->durationIDs.insert(videoID);
+
+    //Requests arriving together are grouped into as few videos calls as possible
+    d->pendingDurationIDs.append(videoID);
+    if(!d->durationBatchTimer->isActive()) d->durationBatchTimer->start();
+
+    emit durationQueueDepthChanged(durationQueueDepth());
 }
 
-void YoutubeAPIManager::suggestionVideoDurationTimeout()
+bool YoutubeAPIManager::audioOnly() const
 {
-    Q_D(YoutubeAPIManager);
+    Q_D(const YoutubeAPIManager);
+    return d->audioOnly;
+}
 
-    QTimer *timer = qobject_cast<QTimer*>(sender());
+void YoutubeAPIManager::setAudioOnly(const bool &audioOnly)
+{
+    Q_D(YoutubeAPIManager);
 
-    if(!timer) return;
+    if(d->audioOnly == audioOnly) return;
+    d->audioOnly = audioOnly;
 
-    QNetworkReply *reply = d->repliesTimeoutMap.value(timer, 0);
-    if(!reply) return;
+    QSettings localSettings(QSettings::IniFormat, QSettings::UserScope, "BeatWhale", "beatwhale_app");
+    localSettings.setValue("audio_only", audioOnly);
 
-    emit suggestionFailed();
+    emit audioOnlyChanged(audioOnly);
+}
 
-    removeTimer(reply);
-    delete reply;
+int YoutubeAPIManager::crossfadeDuration() const
+{
+    Q_D(const YoutubeAPIManager);
+    return d->crossfadeDuration;
 }
 
-void YoutubeAPIManager::videoUrl(const QString &videoID)
+void YoutubeAPIManager::setCrossfadeDuration(const int &msecs)
 {
     Q_D(YoutubeAPIManager);
 
-    if(d->youtubeUpdateProcess->isOpen()) return;
+    int duration = qMax(0, msecs);
+    if(d->crossfadeDuration == duration) return;
+    d->crossfadeDuration = duration;
 
-    if(d->youtubeUrlProcess->isOpen()) d->youtubeUrlProcess->close();
+    QSettings localSettings(QSettings::IniFormat, QSettings::UserScope, "BeatWhale", "beatwhale_app");
+    localSettings.setValue("crossfade_duration", duration);
 
-    QStringList arguments;
-    arguments << "--get-url" << "https://www.youtube.com/watch?v=" + videoID;
-    d->youtubeDurationProcess->setProperty("videoID", videoID);
-    d->youtubeUrlProcess->setArguments(arguments);
-    d->youtubeUrlProcess->open();
+    emit crossfadeDurationChanged(duration);
+}
 
-    connect(d->youtubeUrlProcess, SIGNAL(readyReadStandardOutput()), SLOT(videoUrlFinished()));
-    connect(d->youtubeUrlProcess, SIGNAL(readyReadStandardError()), SLOT(videoUrlError()));
+int YoutubeAPIManager::durationQueueDepth() const
+{
+    Q_D(const YoutubeAPIManager);
+    return d->pendingDurationIDs.count() + d->durationBatchesIDs + d->durationRequests.count();
 }
 
-void YoutubeAPIManager::videoUrlFinished()
+void YoutubeAPIManager::videoDurationBatch()
 {
     Q_D(YoutubeAPIManager);
 
-    if(d->youtubeUrlProcess != sender()) return;
+    while(!d->pendingDurationIDs.isEmpty())
+    {
+        QStringList batchIDs = d->pendingDurationIDs.mid(0, DURATION_BATCH_SIZE);
+        d->pendingDurationIDs = d->pendingDurationIDs.mid(batchIDs.count());
 
-    disconnect(d->youtubeUrlProcess, SIGNAL(readyReadStandardOutput()), this, SLOT(videoUrlFinished()));
-    disconnect(d->youtubeUrlProcess, SIGNAL(readyReadStandardError()), this, SLOT(videoUrlError()));
+        if(!APIRateLimiter::singleton()->acquire(APIRateLimiter::ENDPOINT_VIDEOS, APIRateLimiter::PRIORITY_ESSENTIAL))
+        {
+            videoDurationFallback(batchIDs);
+            continue;
+        }
 
-    QString reply = d->youtubeUrlProcess->readAll();
-    QString videoID = d->youtubeDurationProcess->property("videoID").toString();
+        QUrl url("https://www.googleapis.com/youtube/v3/videos?id=" + batchIDs.join(",") + "&part=contentDetails&fields=" + VIDEOS_FIELDS + "&key=" + d->youtubeAPIKey);
+        QNetworkReply* reply = d->networkManager->get(apiRequest(url));
+        reply->setProperty("ids", batchIDs);
+        connect(reply, SIGNAL(finished()), SLOT(videoDurationBatchFinished()));
+        connect(reply, SIGNAL(error(QNetworkReply::NetworkError)), SLOT(videoDurationBatchError(QNetworkReply::NetworkError)));
 
-    d->youtubeUrlProcess->close();
+        DeadlineScheduler::singleton()->schedule(reply, DeadlineScheduler::REQUEST_VIDEOS);
 
-    reply = reply.replace("\n", "");
-    reply = reply.replace("\r", "");
-    reply = reply.replace(" ", "");
+        d->durationBatchesIDs += batchIDs.count();
+    }
 
-    emit videoUrlSuccess(videoID, reply);
+    emit durationQueueDepthChanged(durationQueueDepth());
 }
 
-void YoutubeAPIManager::videoUrlError()
+void YoutubeAPIManager::videoDurationBatchFinished()
 {
     Q_D(YoutubeAPIManager);
 
-    if(d->youtubeUrlProcess != sender()) return;
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if(!reply) return;
+
+    const QByteArray replyBA = reply->readAll();
+    QStringList batchIDs = reply->property("ids").toStringList();
+    countTransfer("videos", reply, replyBA);
+    DeadlineScheduler::singleton()->cancel(reply);
+    APIRateLimiter::singleton()->reportSuccess();
+    delete reply;
 
-    disconnect(d->youtubeUrlProcess, SIGNAL(readyReadStandardOutput()), this, SLOT(videoUrlFinished()));
-    disconnect(d->youtubeUrlProcess, SIGNAL(readyReadStandardError()), this, SLOT(videoUrlError()));
+    d->durationBatchesIDs -= batchIDs.count();
 
-    QString videoID = d->youtubeDurationProcess->property("videoID").toString();
-    emit videoUrlFailed(videoID);
-}
+    QJsonDocument document = QJsonDocument::fromJson(replyBA);
 
-void YoutubeAPIManager::videoDuration(const QString &videoID)
-{
-    Q_D(YoutubeAPIManager);
+    QJsonObject object = document.object();
+    QJsonArray searchItems = object.value("items").toArray();
 
-    if(d->youtubeDurationProcess->isOpen() || d->youtubeUpdateProcess->isOpen())
+    for(int i = 0; i < searchItems.count(); ++i)
     {
-        d->videoDurationRequests.append(videoID);
-        return;
+        QJsonObject resultObj = searchItems.at(i).toObject();
+        QString videoID = resultObj.value("id").toString();
+        QJsonObject detailsObj = resultObj.value("contentDetails").toObject();
+        QString duration = formatDuration(detailsObj.value("duration").toString());
+
+        if(duration.isEmpty()) continue;
+
+        batchIDs.removeAll(videoID);
+        d->durationIDs.remove(videoID);
+        VideoDetailsStore::singleton()->insert(videoID, QString(), QString(), duration);
+        emit videoDurationSuccess(videoID, duration);
     }
 
-    QStringList arguments;
-    arguments << "--get-duration" << "https://www.youtube.com/watch?v=" + videoID;
-    d->youtubeDurationProcess->setProperty("videoID", videoID);
-    d->youtubeDurationProcess->setArguments(arguments);
-    d->youtubeDurationProcess->open();
+    //Whatever the API did not answer goes to youtube-dl
+    videoDurationFallback(batchIDs);
 
-    connect(d->youtubeDurationProcess, SIGNAL(finished(int)), SLOT(videoDurationFinished()));
-    connect(d->youtubeDurationProcess, SIGNAL(readyReadStandardOutput()), SLOT(videoDurationFinished()));
+    emit durationQueueDepthChanged(durationQueueDepth());
 }
 
-void YoutubeAPIManager::videoDurationFinished()
+void YoutubeAPIManager::videoDurationBatchError(QNetworkReply::NetworkError error)
 {
     Q_D(YoutubeAPIManager);
 
-    if(d->youtubeDurationProcess != sender()) return;
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if(!reply) return;
 
-    disconnect(d->youtubeDurationProcess, SIGNAL(finished(int)), this, SLOT(videoDurationFinished()));
-    disconnect(d->youtubeDurationProcess, SIGNAL(readyReadStandardOutput()), this, SLOT(videoDurationFinished()));
+    APIRateLimiter::singleton()->reportFailure(reply);
 
-    QString duration = d->youtubeDurationProcess->readAll();
-    QString videoID = d->youtubeDurationProcess->property("videoID").toString();
+    QStringList batchIDs = reply->property("ids").toStringList();
 
+    disconnect(reply, 0, this, 0);
+    DeadlineScheduler::singleton()->cancel(reply);
+    reply->deleteLater();
 
-    d->youtubeDurationProcess->close();
+    d->durationBatchesIDs -= batchIDs.count();
 
-    if(!duration.isEmpty())
-    {
-        duration.remove("\n");
-        duration.remove("\r");
-        emit videoDurationSuccess(videoID, duration);
-    }
+    videoDurationFallback(batchIDs);
 
-    if(d->videoDurationRequests.count())
+    emit durationQueueDepthChanged(durationQueueDepth());
+}
+
+void YoutubeAPIManager::videoDurationFallback(const QStringList &videosIDs)
+{
+    Q_D(YoutubeAPIManager);
+
+    foreach(QString videoID, videosIDs)
     {
-        QString videoID = d->videoDurationRequests.takeFirst();
-        videoDuration(videoID);
+        //A stream URL extraction for the same video answers the duration as well
+        int requestID = d->urlRequestIDs.value(videoID, 0);
+        if(!requestID) requestID = d->urlPool->resolve(videoID, true);
+        d->durationRequests.insert(requestID, videoID);
+        d->durationRequestIDs.insert(videoID, requestID);
     }
 }
 
@@ -730,15 +1757,27 @@ void YoutubeAPIManager::updateYoutubeDL()
 {
     Q_D(YoutubeAPIManager);
 
+    if(d->youtubeUpdateProcess->state() != QProcess::NotRunning || d->youtubeVerifyProcess->state() != QProcess::NotRunning) return;
+
     qDebug() << "Youtube DL Update...";
 
-    QStringList arguments;
-    arguments << "--update";
-    d->youtubeUpdateProcess->setArguments(arguments);
-    d->youtubeUpdateProcess->open();
+    //The update runs on a staged copy, resolutions keep using the current binary meanwhile
+    QString stagingPath = d->youtubeDLUpdatesPath + "/" + youtubeDLFileName("youtube-dl-staging");
+    QFile::remove(stagingPath);
+    QFile::remove(stagingPath + ".new");
 
-    connect(d->youtubeUpdateProcess, SIGNAL(finished(int)), SLOT(youtubeDLUpdateFinished()));
-    connect(d->youtubeUpdateProcess, SIGNAL(readyReadStandardError()), SLOT(youtubeDLUpdateError()));
+    if(!QFile::copy(d->youtubeDLProgramPath, stagingPath))
+    {
+        qDebug() << "Youtube DL could not be staged at" << stagingPath;
+        emit youtubeDLUpdateFailed();
+        return;
+    }
+
+    d->youtubeUpdateProcess->setProgram(stagingPath);
+    d->youtubeUpdateProcess->setArguments(QStringList() << "--update");
+    d->youtubeUpdateProcess->start();
+
+    DeadlineScheduler::singleton()->schedule(d->youtubeUpdateProcess, YOUTUBEDL_UPDATE_DEADLINE);
 }
 
 void YoutubeAPIManager::youtubeDLUpdateFinished()
@@ -749,56 +1788,108 @@ void YoutubeAPIManager::youtubeDLUpdateFinished()
 
     if(d->youtubeUpdateProcess != sender()) return;
 
-    qDebug() << d->youtubeUpdateProcess->readAll();
+    DeadlineScheduler::singleton()->cancel(d->youtubeUpdateProcess);
 
-    QString youtubeDLProgramPath;
-    QString youtubeDLNewProgramPath;
-    QString youtubeDLBatPath = QString(QCoreApplication::applicationDirPath() + "/" + "youtube-dl-updater.bat");
+    QString output = d->youtubeUpdateProcess->readAllStandardOutput();
+    qDebug() << output;
 
-#ifdef Q_OS_MAC
-    youtubeDLProgramPath = QString(QCoreApplication::applicationDirPath() + "/" + "youtube-dl");
-    youtubeDLNewProgramPath = QString(QCoreApplication::applicationDirPath() + "/" + "youtube-dl.new");
-#else
-    youtubeDLProgramPath = QString(QCoreApplication::applicationDirPath() + "/" + "youtube-dl.exe");
-    youtubeDLNewProgramPath = QString(QCoreApplication::applicationDirPath() + "/" + "youtube-dl.exe.new");
-#endif
+    if(d->youtubeUpdateProcess->exitStatus() != QProcess::NormalExit || d->youtubeUpdateProcess->exitCode() != 0)
+    {
+        qDebug() << d->youtubeUpdateProcess->readAllStandardError();
+        youtubeDLUpdateFailure();
+        return;
+    }
+
+    QString stagingPath = d->youtubeUpdateProcess->program();
+
+    if(output.contains("up-to-date"))
+    {
+        QFile::remove(stagingPath);
+        emit youtubeDLUpdateSuccess();
+        return;
+    }
+
+    //Windows builds cannot overwrite themselves, the new executable is left next to the old one with an updater script
+    if(QFile::exists(stagingPath + ".new"))
+    {
+        QFile::remove(d->youtubeDLUpdatesPath + "/" + "youtube-dl-updater.bat");
+        QFile::remove(stagingPath);
+        QFile::rename(stagingPath + ".new", stagingPath);
+    }
+
+    //The downloaded binary has to run before it replaces the current one
+    d->youtubeVerifyProcess->setProgram(stagingPath);
+    d->youtubeVerifyProcess->setArguments(QStringList() << "--version");
+    d->youtubeVerifyProcess->start();
+
+    DeadlineScheduler::singleton()->schedule(d->youtubeVerifyProcess, DeadlineScheduler::REQUEST_PROCESS);
+}
+
+void YoutubeAPIManager::youtubeDLVerifyFinished()
+{
+    Q_D(YoutubeAPIManager);
 
-    if(QFile::exists(youtubeDLNewProgramPath))
+    if(d->youtubeVerifyProcess != sender()) return;
+
+    DeadlineScheduler::singleton()->cancel(d->youtubeVerifyProcess);
+
+    QString version = QString(d->youtubeVerifyProcess->readAllStandardOutput()).trimmed();
+
+    if(d->youtubeVerifyProcess->exitStatus() != QProcess::NormalExit || d->youtubeVerifyProcess->exitCode() != 0 ||
+            !QRegularExpression("^\\d{4}\\.\\d{2}\\.\\d{2}(\\.\\d+)?$").match(version).hasMatch())
+    {
+        qDebug() << "Youtube DL update could not be verified" << version;
+        youtubeDLUpdateFailure();
+        return;
+    }
+
+    QString programPath = d->youtubeDLUpdatesPath + "/" + youtubeDLFileName("youtube-dl-" + version);
+    QFile::remove(programPath);
+    if(!QFile::rename(d->youtubeVerifyProcess->program(), programPath))
     {
-        QFile::remove(youtubeDLProgramPath);
-        QFile::remove(youtubeDLBatPath);
-        QFile::rename(youtubeDLNewProgramPath, youtubeDLProgramPath);
+        youtubeDLUpdateFailure();
+        return;
     }
 
-    disconnect(d->youtubeUpdateProcess, SIGNAL(finished(int)), this, SLOT(videoDurationFinished()));
-    disconnect(d->youtubeUpdateProcess, SIGNAL(readyReadStandardError()), this, SLOT(videoDurationFinished()));
+    //Workers extracting right now finish with the previous binary, every new resolution uses the update
+    QString previousProgramPath = d->youtubeDLProgramPath;
+    d->youtubeDLProgramPath = programPath;
+    d->urlPool->setProgram(programPath);
 
-    d->youtubeUpdateProcess->close();
+    QSettings localSettings(QSettings::IniFormat, QSettings::UserScope, "BeatWhale", "beatwhale_app");
+    localSettings.setValue("youtubedl_program", programPath);
+
+    //A previous update still running cannot be removed on Windows, it is cleaned up at the next start
+    if(previousProgramPath.startsWith(d->youtubeDLUpdatesPath)) QFile::remove(previousProgramPath);
+
+    qDebug() << "Youtube DL updated to" << version;
 
     emit youtubeDLUpdateSuccess();
 }
 
-void YoutubeAPIManager::youtubeDLUpdateError()
+void YoutubeAPIManager::youtubeDLUpdateError(QProcess::ProcessError error)
 {
     Q_D(YoutubeAPIManager);
 
-    qDebug() << "Youtube DL Update Error";
+    //Every other error is followed by finished()
+    if(error != QProcess::FailedToStart) return;
 
-    if(d->youtubeUpdateProcess != sender()) return;
+    qDebug() << "Youtube DL Update Error";
 
-    disconnect(d->youtubeUpdateProcess, SIGNAL(finished(int)), this, SLOT(videoDurationFinished()));
-    disconnect(d->youtubeUpdateProcess, SIGNAL(readyReadStandardError()), this, SLOT(videoDurationFinished()));
+    if(d->youtubeUpdateProcess != sender() && d->youtubeVerifyProcess != sender()) return;
 
-    d->youtubeUpdateProcess->close();
+    DeadlineScheduler::singleton()->cancel(sender());
 
-    emit youtubeDLUpdateFailed();
+    youtubeDLUpdateFailure();
 }
 
-void YoutubeAPIManager::removeTimer(QNetworkReply *reply)
+void YoutubeAPIManager::youtubeDLUpdateFailure()
 {
     Q_D(YoutubeAPIManager);
 
-    QTimer *timer = d->repliesTimeoutMap.key(reply, 0);
-    if(timer) d->repliesTimeoutMap.remove(timer);
-    delete timer;
+    QString stagingPath = d->youtubeDLUpdatesPath + "/" + youtubeDLFileName("youtube-dl-staging");
+    QFile::remove(stagingPath);
+    QFile::remove(stagingPath + ".new");
+
+    emit youtubeDLUpdateFailed();
 }
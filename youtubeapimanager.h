@@ -4,9 +4,15 @@
 #include <QObject>
 
 #include <QNetworkReply>
+#include <QProcess>
+
+#include "searchresultsmodel.h"
 
 class QQmlEngine;
 class QJSEngine;
+class SearchCache;
+class YoutubeDLPool;
+struct SearchRequest;
 class YoutubeAPIManagerPrivate;
 class YoutubeAPIManager : public QObject
 {
@@ -15,6 +21,10 @@ class YoutubeAPIManager : public QObject
     Q_ENUMS(OrderFilter)
     Q_ENUMS(DurationFilter)
 
+    Q_PROPERTY(int durationQueueDepth READ durationQueueDepth NOTIFY durationQueueDepthChanged)
+    Q_PROPERTY(bool audioOnly READ audioOnly WRITE setAudioOnly NOTIFY audioOnlyChanged)
+    Q_PROPERTY(int crossfadeDuration READ crossfadeDuration WRITE setCrossfadeDuration NOTIFY crossfadeDurationChanged)
+
 public:
     enum OrderFilter
     {
@@ -37,26 +47,44 @@ public:
 
     void setAPIKey(const QString& key);
 
-    void shutdown();
+    SearchCache* searchCache() const;
+    YoutubeDLPool* urlPool() const;
+
+    Q_INVOKABLE QVariantMap transferStatistics() const;
+
+    int durationQueueDepth() const;
 
-    void removeTimer(QNetworkReply *reply);
+    bool audioOnly() const;
+    Q_INVOKABLE void setAudioOnly(const bool& audioOnly);
 
+    int crossfadeDuration() const;
+    Q_INVOKABLE void setCrossfadeDuration(const int& msecs);
+
+    void addQueuedID(const QString& id);
+    void removeQueuedID(const QString& id);
+    void clearQueuedIDs();
+
+    void shutdown();
 
     Q_INVOKABLE void setMusicOnlyFilter(const bool& onlyMusic);
     Q_INVOKABLE void setOrderFilter(OrderFilter orderFilter);
     Q_INVOKABLE void setDurationFilter(DurationFilter durationFilter);
+    Q_INVOKABLE void setPrefetchEnabled(const bool& enabled);
 
 signals:
-    void searchSuccess(const QString& documentString);
-    void searchFailed();
+    void searchSuccess(const int& requestID);
+    void searchFailed(const int& requestID);
 
     void suggestionSuccess(const QString& id, const QString& title, const QString& thumbnail, const QString& duration);
     void suggestionFailed();
 
-    void videoUrlFailed(const QString& id);
-    void videoUrlSuccess(const QString& id, const QString& url);
-    void videoDurationFailed();
+    void videoUrlFailed(const QString& id, const int& token);
+    void videoUrlSuccess(const QString& id, const QString& url, const int& token);
+    void videoDurationFailed(const QString& id);
     void videoDurationSuccess(const QString& id, const QString& duration);
+    void durationQueueDepthChanged(const int& depth);
+    void audioOnlyChanged(const bool& audioOnly);
+    void crossfadeDurationChanged(const int& msecs);
 
     void youtubeDLUpdateFailed();
     void youtubeDLUpdateSuccess();
@@ -64,43 +92,60 @@ signals:
 public slots:
     void ignoreSSLErrors(QNetworkReply *reply, QList<QSslError> errors);
 
-    Q_INVOKABLE void search(const QString& search, const QString& nextPageToken = "");
-    Q_INVOKABLE void suggestion(const QString& id, const QStringList excludeSuggestionIDs);
-    Q_INVOKABLE void videoUrl(const QString& videoID);
+    Q_INVOKABLE int search(SearchResultsModel *model, const QString& search, const QString& nextPageToken = "");
+    Q_INVOKABLE void cancelSearch(const int& requestID);
+    Q_INVOKABLE void suggestion(const QString& id);
+    Q_INVOKABLE int videoUrl(const QString& videoID, const bool& withVideo = false);
+    Q_INVOKABLE void preresolveVideoUrl(const QString& videoID);
+    Q_INVOKABLE QString prerollVideoUrl(const QString& videoID, const bool& withVideo = false);
+    Q_INVOKABLE void prerolledVideoPlayed(const QString& videoID);
     Q_INVOKABLE void videoDuration(const QString& videoID);
+    Q_INVOKABLE QVariantMap videoInfo(const QString& videoID);
     Q_INVOKABLE void updateYoutubeDL();
 
 private slots:
     void searchFinished();
+    void searchCompleted(const int& requestID);
+    void searchDropped(const int& requestID);
     void searchError(QNetworkReply::NetworkError error);
-    void searchTimeout();
 
-    void searchVideosDuration(const QString& videosIDs);
+    void searchVideosDuration(const int& requestID, const QString& videosIDs);
     void searchVideosDurationFinished();
-    void searchVideosDurationError(QNetworkReply::NetworkError error);
-    void searchVideosDurationTimeout();
 
     void suggestionFinished();
     void suggestionError(QNetworkReply::NetworkError error);
-    void suggestionTimeout();
 
-    void suggestionVideoDuration(const QString& id, const QString &title, const QString &thumbnail);
-    void suggestionVideoDurationFinished();
-    void suggestionVideoDurationError(QNetworkReply::NetworkError error);
-    void suggestionVideoDurationTimeout();
+    void suggestionDurationsFinished();
+    void suggestionDurationsError(QNetworkReply::NetworkError error);
 
-    void videoUrlFinished();
-    void videoUrlError();
+    void videoUrlDebounced();
+    void videoInfoFinished(const int& requestID, const QString& videoID, const QByteArray& output, const int& elapsed);
+    void videoInfoError(const int& requestID, const QString& videoID, const QString& error);
 
-    void videoDurationFinished();
+    void videoDurationBatch();
+    void videoDurationBatchFinished();
+    void videoDurationBatchError(QNetworkReply::NetworkError error);
 
     void youtubeDLUpdateFinished();
-    void youtubeDLUpdateError();
+    void youtubeDLVerifyFinished();
+    void youtubeDLUpdateError(QProcess::ProcessError error);
 
 private:
     explicit YoutubeAPIManager(QObject *parent = 0);
     virtual ~YoutubeAPIManager();
 
+    bool sendSearchRequest(SearchRequest *request);
+    void prefetchSearch(const SearchRequest *origin);
+    void countTransfer(const QString& endpoint, QNetworkReply *reply, const QByteArray& payload);
+    void searchFailure(QNetworkReply *reply);
+    void resolveVideoUrl(const QString& videoID);
+    void videoDurationFallback(const QStringList& videosIDs);
+    void youtubeDLUpdateFailure();
+
+    bool requestSuggestionPool(const QString& seed);
+    bool serveSuggestion(const QString& seed);
+    void suggestionPoolReady(const QString& seed);
+
     static YoutubeAPIManager *_singleton;
 
     Q_DECLARE_PRIVATE(YoutubeAPIManager)
@@ -0,0 +1,478 @@
+#include "youtubedlpool.h"
+#include "deadlinescheduler.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QQueue>
+#include <QTimer>
+#include <QDebug>
+
+#define IDLE_TIMEOUT 60000
+#define RETIRE_INTERVAL 15000
+#define START_FAILURES_MAXIMUM 3
+#define BACKGROUND_WORKERS_MAXIMUM 1
+
+struct YoutubeDLRequest
+{
+    YoutubeDLRequest() : id(0) {}
+
+    int id;
+    QString videoID;
+    QElapsedTimer elapsed;
+};
+
+struct YoutubeDLWorker
+{
+    YoutubeDLWorker() : process(0), requestID(0), background(false), ready(false), retiring(false), idleSince(0) {}
+
+    QProcess *process;
+    int requestID;
+    QString videoID;
+    QElapsedTimer elapsed;
+    bool background;
+    bool ready;
+    bool retiring;
+    qint64 idleSince;
+};
+
+class YoutubeDLPoolPrivate
+{
+public:
+    YoutubeDLPoolPrivate() :
+        minimumSize(2),
+        maximumSize(4),
+        lastRequestID(0),
+        lastResolveTime(0),
+        averageResolveTime(0),
+        startFailures(0),
+        retireTimer(0)
+    {}
+
+    virtual ~YoutubeDLPoolPrivate()
+    {
+        qDeleteAll(workers);
+    }
+
+    int idleCount() const
+    {
+        int count = 0;
+        foreach(YoutubeDLWorker *worker, workers)
+        {
+            if(worker->ready && !worker->requestID && !worker->retiring) ++count;
+        }
+        return count;
+    }
+
+    int liveCount() const
+    {
+        int count = 0;
+        foreach(YoutubeDLWorker *worker, workers)
+        {
+            if(!worker->retiring) ++count;
+        }
+        return count;
+    }
+
+    int backgroundCount() const
+    {
+        int count = 0;
+        foreach(YoutubeDLWorker *worker, workers)
+        {
+            if(worker->requestID && worker->background) ++count;
+        }
+        return count;
+    }
+
+    int startingCount() const
+    {
+        int count = 0;
+        foreach(YoutubeDLWorker *worker, workers)
+        {
+            if(!worker->ready && !worker->retiring) ++count;
+        }
+        return count;
+    }
+
+    QString program;
+    QStringList arguments;
+
+    int minimumSize;
+    int maximumSize;
+
+    QHash<QProcess*, YoutubeDLWorker*> workers;
+    QQueue<YoutubeDLRequest> queue;
+    QQueue<YoutubeDLRequest> backgroundQueue;
+    int lastRequestID;
+
+    int lastResolveTime;
+    double averageResolveTime;
+
+    int startFailures;
+    QString startError;
+
+    QTimer *retireTimer;
+};
+
+YoutubeDLPool::YoutubeDLPool(const QString &program, const QStringList &arguments, QObject *parent) :
+    QObject(parent),
+    d_ptr(new YoutubeDLPoolPrivate)
+{
+    Q_D(YoutubeDLPool);
+
+    d->program = program;
+    d->arguments = arguments;
+
+    d->retireTimer = new QTimer(this);
+    d->retireTimer->setInterval(RETIRE_INTERVAL);
+    d->retireTimer->start();
+    connect(d->retireTimer, SIGNAL(timeout()), SLOT(retireIdleWorkers()));
+}
+
+YoutubeDLPool::~YoutubeDLPool()
+{
+    Q_D(YoutubeDLPool);
+
+    foreach(QProcess *process, d->workers.keys())
+    {
+        disconnect(process, 0, this, 0);
+        process->kill();
+    }
+
+    delete d_ptr;
+}
+
+int YoutubeDLPool::minimumSize() const
+{
+    Q_D(const YoutubeDLPool);
+    return d->minimumSize;
+}
+
+void YoutubeDLPool::setMinimumSize(const int &size)
+{
+    Q_D(YoutubeDLPool);
+
+    d->minimumSize = qMax(0, size);
+    if(d->maximumSize < d->minimumSize) d->maximumSize = d->minimumSize;
+
+    dispatch();
+}
+
+int YoutubeDLPool::maximumSize() const
+{
+    Q_D(const YoutubeDLPool);
+    return d->maximumSize;
+}
+
+void YoutubeDLPool::setMaximumSize(const int &size)
+{
+    Q_D(YoutubeDLPool);
+
+    d->maximumSize = qMax(1, size);
+    if(d->minimumSize > d->maximumSize) d->minimumSize = d->maximumSize;
+}
+
+QString YoutubeDLPool::program() const
+{
+    Q_D(const YoutubeDLPool);
+    return d->program;
+}
+
+void YoutubeDLPool::setProgram(const QString &program)
+{
+    Q_D(YoutubeDLPool);
+
+    if(d->program == program) return;
+    d->program = program;
+    d->startFailures = 0;
+
+    //Busy workers finish with the previous program, idle ones are replaced right away
+    foreach(YoutubeDLWorker *worker, d->workers.values())
+    {
+        if(worker->requestID || worker->retiring) continue;
+
+        worker->retiring = true;
+        worker->process->kill();
+    }
+
+    dispatch();
+}
+
+int YoutubeDLPool::resolve(const QString &videoID, const bool &background)
+{
+    Q_D(YoutubeDLPool);
+
+    YoutubeDLRequest request;
+    request.id = ++d->lastRequestID;
+    request.videoID = videoID;
+    request.elapsed.start();
+
+    //Background requests never hold up playback, they only get the workers the foreground queue leaves
+    if(background) d->backgroundQueue.enqueue(request);
+    else d->queue.enqueue(request);
+
+    dispatch();
+
+    return request.id;
+}
+
+void YoutubeDLPool::promote(const int &requestID)
+{
+    Q_D(YoutubeDLPool);
+
+    for(int i = 0; i < d->backgroundQueue.count(); ++i)
+    {
+        if(d->backgroundQueue.at(i).id != requestID) continue;
+
+        d->queue.enqueue(d->backgroundQueue.takeAt(i));
+        dispatch();
+        return;
+    }
+
+    //A running background request now counts as a foreground one
+    foreach(YoutubeDLWorker *worker, d->workers.values())
+    {
+        if(worker->requestID == requestID) worker->background = false;
+    }
+}
+
+void YoutubeDLPool::cancel(const int &requestID)
+{
+    Q_D(YoutubeDLPool);
+
+    for(int i = 0; i < d->queue.count(); ++i)
+    {
+        if(d->queue.at(i).id != requestID) continue;
+
+        d->queue.removeAt(i);
+        emit statisticsChanged();
+        return;
+    }
+
+    for(int i = 0; i < d->backgroundQueue.count(); ++i)
+    {
+        if(d->backgroundQueue.at(i).id != requestID) continue;
+
+        d->backgroundQueue.removeAt(i);
+        emit statisticsChanged();
+        return;
+    }
+
+    //A worker that already got the URL cannot be stopped midway, it is killed and replaced
+    foreach(YoutubeDLWorker *worker, d->workers.values())
+    {
+        if(worker->requestID != requestID) continue;
+
+        worker->requestID = 0;
+        worker->process->kill();
+        return;
+    }
+}
+
+int YoutubeDLPool::size() const
+{
+    Q_D(const YoutubeDLPool);
+    return d->workers.count();
+}
+
+int YoutubeDLPool::idle() const
+{
+    Q_D(const YoutubeDLPool);
+    return d->idleCount();
+}
+
+int YoutubeDLPool::pending() const
+{
+    Q_D(const YoutubeDLPool);
+    return d->queue.count() + d->backgroundQueue.count();
+}
+
+int YoutubeDLPool::lastResolveTime() const
+{
+    Q_D(const YoutubeDLPool);
+    return d->lastResolveTime;
+}
+
+int YoutubeDLPool::averageResolveTime() const
+{
+    Q_D(const YoutubeDLPool);
+    return int(d->averageResolveTime);
+}
+
+void YoutubeDLPool::spawnWorker()
+{
+    Q_D(YoutubeDLPool);
+
+    //The worker starts the interpreter and loads the extractors now, then blocks reading its batch file from stdin
+    QProcess *process = new QProcess(this);
+    process->setProgram(d->program);
+    process->setArguments(d->arguments + (QStringList() << "--batch-file" << "-"));
+    connect(process, SIGNAL(started()), SLOT(workerStarted()));
+    connect(process, SIGNAL(finished(int)), SLOT(workerFinished()));
+    connect(process, SIGNAL(error(QProcess::ProcessError)), SLOT(workerError(QProcess::ProcessError)));
+
+    YoutubeDLWorker *worker = new YoutubeDLWorker;
+    worker->process = process;
+    d->workers.insert(process, worker);
+
+    process->start();
+}
+
+void YoutubeDLPool::dispatch()
+{
+    Q_D(YoutubeDLPool);
+
+    while(!d->queue.isEmpty() || (!d->backgroundQueue.isEmpty() && d->backgroundCount() < BACKGROUND_WORKERS_MAXIMUM))
+    {
+        YoutubeDLWorker *worker = 0;
+        foreach(YoutubeDLWorker *candidate, d->workers.values())
+        {
+            if(candidate->ready && !candidate->requestID && !candidate->retiring)
+            {
+                worker = candidate;
+                break;
+            }
+        }
+
+        if(!worker) break;
+
+        const bool background = d->queue.isEmpty();
+        YoutubeDLRequest request = background ? d->backgroundQueue.dequeue() : d->queue.dequeue();
+        worker->requestID = request.id;
+        worker->videoID = request.videoID;
+        worker->elapsed = request.elapsed;
+        worker->background = background;
+
+        //youtube-dl reads the whole batch before extracting, closing stdin hands it the single URL
+        worker->process->write(QString("https://www.youtube.com/watch?v=" + request.videoID + "\n").toUtf8());
+        worker->process->closeWriteChannel();
+
+        DeadlineScheduler::singleton()->schedule(worker->process, DeadlineScheduler::REQUEST_PROCESS);
+    }
+
+    //Workers still starting count towards what is waiting, the rest is spawned up to the maximum
+    int starting = d->startingCount();
+    int backgroundWanted = qMin(d->backgroundQueue.count(), qMax(0, BACKGROUND_WORKERS_MAXIMUM - d->backgroundCount()));
+    int missing = qMax(d->queue.count() + backgroundWanted - starting, d->minimumSize - d->idleCount() - starting);
+
+    //After repeated start failures no more workers are spawned until the next retire check
+    if(d->startFailures < START_FAILURES_MAXIMUM)
+    {
+        while(missing-- > 0 && d->workers.count() < d->maximumSize) spawnWorker();
+    }
+
+    //Nothing left that could take the waiting requests, they fail now
+    if((!d->queue.isEmpty() || !d->backgroundQueue.isEmpty()) && !d->liveCount())
+    {
+        while(!d->queue.isEmpty())
+        {
+            YoutubeDLRequest request = d->queue.dequeue();
+            emit failed(request.id, request.videoID, d->startError);
+        }
+        while(!d->backgroundQueue.isEmpty())
+        {
+            YoutubeDLRequest request = d->backgroundQueue.dequeue();
+            emit failed(request.id, request.videoID, d->startError);
+        }
+    }
+
+    emit statisticsChanged();
+}
+
+void YoutubeDLPool::workerStarted()
+{
+    Q_D(YoutubeDLPool);
+
+    QProcess *process = qobject_cast<QProcess*>(sender());
+    YoutubeDLWorker *worker = d->workers.value(process, 0);
+    if(!worker) return;
+
+    worker->ready = true;
+    worker->idleSince = QDateTime::currentMSecsSinceEpoch();
+    d->startFailures = 0;
+
+    dispatch();
+}
+
+void YoutubeDLPool::workerFinished()
+{
+    Q_D(YoutubeDLPool);
+
+    QProcess *process = qobject_cast<QProcess*>(sender());
+    YoutubeDLWorker *worker = d->workers.take(process);
+    if(!worker) return;
+
+    DeadlineScheduler::singleton()->cancel(process);
+
+    const QByteArray output = process->readAllStandardOutput();
+    const QString errorOutput = process->readAllStandardError();
+    const bool success = process->exitStatus() == QProcess::NormalExit && process->exitCode() == 0 && !output.trimmed().isEmpty();
+
+    process->deleteLater();
+
+    const int requestID = worker->requestID;
+    const QString videoID = worker->videoID;
+    const int elapsed = worker->elapsed.isValid() ? int(worker->elapsed.elapsed()) : 0;
+    delete worker;
+
+    if(requestID)
+    {
+        if(success)
+        {
+            d->lastResolveTime = elapsed;
+            d->averageResolveTime = d->averageResolveTime ? d->averageResolveTime * 0.8 + elapsed * 0.2 : elapsed;
+            qDebug() << "Youtube DL resolved" << videoID << "in" << elapsed << "ms";
+
+            emit resolved(requestID, videoID, output, elapsed);
+        }
+        else
+        {
+            emit failed(requestID, videoID, errorOutput);
+        }
+    }
+
+    dispatch();
+}
+
+void YoutubeDLPool::workerError(QProcess::ProcessError error)
+{
+    Q_D(YoutubeDLPool);
+
+    //Every other error is followed by finished()
+    if(error != QProcess::FailedToStart) return;
+
+    QProcess *process = qobject_cast<QProcess*>(sender());
+    YoutubeDLWorker *worker = d->workers.take(process);
+    if(!worker) return;
+
+    qDebug() << "Youtube DL worker could not be started" << d->program;
+
+    d->startError = process->errorString();
+    ++d->startFailures;
+    process->deleteLater();
+    delete worker;
+
+    //The other workers keep serving the queue, it only fails once none is left
+    dispatch();
+}
+
+void YoutubeDLPool::retireIdleWorkers()
+{
+    Q_D(YoutubeDLPool);
+
+    int idleCount = d->idleCount();
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    //Starting workers is tried again from time to time
+    d->startFailures = 0;
+
+    foreach(YoutubeDLWorker *worker, d->workers.values())
+    {
+        if(idleCount <= d->minimumSize) break;
+        if(!worker->ready || worker->requestID || worker->retiring || now - worker->idleSince < IDLE_TIMEOUT) continue;
+
+        //The killed worker is removed in workerFinished without being replaced, the minimum is still warm
+        worker->retiring = true;
+        worker->process->kill();
+        --idleCount;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef YOUTUBEDLPOOL_H
+#define YOUTUBEDLPOOL_H
+
+#include <QObject>
+#include <QStringList>
+#include <QProcess>
+
+class YoutubeDLPoolPrivate;
+class YoutubeDLPool : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int size READ size NOTIFY statisticsChanged)
+    Q_PROPERTY(int idle READ idle NOTIFY statisticsChanged)
+    Q_PROPERTY(int pending READ pending NOTIFY statisticsChanged)
+    Q_PROPERTY(int lastResolveTime READ lastResolveTime NOTIFY statisticsChanged)
+    Q_PROPERTY(int averageResolveTime READ averageResolveTime NOTIFY statisticsChanged)
+
+public:
+    explicit YoutubeDLPool(const QString& program, const QStringList& arguments, QObject *parent = 0);
+    virtual ~YoutubeDLPool();
+
+    int minimumSize() const;
+    void setMinimumSize(const int& size);
+
+    int maximumSize() const;
+    void setMaximumSize(const int& size);
+
+    QString program() const;
+    void setProgram(const QString& program);
+
+    int resolve(const QString& videoID, const bool& background = false);
+    void promote(const int& requestID);
+    void cancel(const int& requestID);
+
+    int size() const;
+    int idle() const;
+    int pending() const;
+    int lastResolveTime() const;
+    int averageResolveTime() const;
+
+signals:
+    void resolved(const int& requestID, const QString& videoID, const QByteArray& output, const int& elapsed);
+    void failed(const int& requestID, const QString& videoID, const QString& error);
+    void statisticsChanged();
+
+private slots:
+    void workerStarted();
+    void workerFinished();
+    void workerError(QProcess::ProcessError error);
+    void retireIdleWorkers();
+
+private:
+    void spawnWorker();
+    void dispatch();
+
+    Q_DECLARE_PRIVATE(YoutubeDLPool)
+    YoutubeDLPoolPrivate * const d_ptr;
+
+};
+
+#endif // YOUTUBEDLPOOL_H